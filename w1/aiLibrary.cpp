@@ -1,6 +1,7 @@
 #include "aiLibrary.h"
 #include <flecs.h>
 #include "ecsTypes.h"
+#include "spatialHash.h"
 #include "raylib.h"
 #include <cfloat>
 #include <cmath>
@@ -11,7 +12,7 @@ class AttackEnemyState : public State
 public:
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &/*ecs*/, flecs::entity /*entity*/) const override {}
+  void act(float/* dt*/, flecs::world &/*ecs*/, std::span<FsmAgent> /*agents*/) const override {}
 };
 
 template<typename T>
@@ -41,30 +42,46 @@ static int inverse_move(int move)
          move == EA_MOVE_DOWN ? EA_MOVE_UP : move;
 }
 
-
-template<typename Callable>
-static void on_closest_enemy_pos(flecs::world &ecs, flecs::entity entity, Callable c)
+void gather_fsm_agents(flecs::world &ecs, std::vector<FsmAgent> &agents)
 {
-  static auto enemiesQuery = ecs.query<const Position, const Team>();
-  entity.set([&](const Position &pos, const Team &t, Action &a)
+  static auto agentsQuery = ecs.query<StateMachine, const Position, const Team, const Hitpoints, Action>();
+  const SpatialHash &spatialHash = get_spatial_hash();
+  static std::vector<SpatialEntry> closest;
+
+  agents.clear();
+  agentsQuery.each([&](flecs::entity e, StateMachine &sm, const Position &pos, const Team &t, const Hitpoints &hp,
+                       Action &a)
   {
-    flecs::entity closestEnemy;
-    float closestDist = FLT_MAX;
-    Position closestPos;
-    enemiesQuery.each([&](flecs::entity enemy, const Position &epos, const Team &et)
+    FsmAgent &agent = agents.emplace_back();
+    agent.entity = e;
+    agent.sm = &sm;
+    agent.action = &a;
+    agent.pos = pos;
+    agent.hitpoints = hp.hitpoints;
+    e.get([&](const HealCooldown &cd)
     {
-      if (t.team == et.team)
-        return;
-      float curDist = dist(epos, pos);
-      if (curDist < closestDist)
-      {
-        closestDist = curDist;
-        closestPos = epos;
-        closestEnemy = enemy;
-      }
+      agent.healReady = cd.cur == cd.cooldown;
     });
-    if (ecs.is_valid(closestEnemy))
-      c(a, pos, closestPos);
+    // nearby cells of the hash instead of a pass over everyone
+    spatialHash.k_nearest(pos, t.team, TeamFilter::OtherTeams, 1, closest);
+    if (!closest.empty())
+    {
+      agent.enemy = closest[0].entity;
+      agent.enemyPos = closest[0].pos;
+      agent.enemyDist = dist(closest[0].pos, pos);
+    }
+    spatialHash.k_nearest(pos, t.team, TeamFilter::SameTeam, 1, closest, e);
+    if (!closest.empty())
+    {
+      agent.ally = closest[0].entity;
+      agent.allyPos = closest[0].pos;
+      agent.allyDist = dist(closest[0].pos, pos);
+    }
+    if (agent.ally)
+      agent.ally.get([&](const Hitpoints &allyHp)
+      {
+        agent.allyHitpoints = allyHp.hitpoints;
+      });
   });
 }
 
@@ -73,12 +90,11 @@ class MoveToEnemyState : public State
 public:
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity) const override
+  void act(float/* dt*/, flecs::world &/*ecs*/, std::span<FsmAgent> agents) const override
   {
-    on_closest_enemy_pos(ecs, entity, [&](Action &a, const Position &pos, const Position &enemy_pos)
-    {
-      a.action = move_towards(pos, enemy_pos);
-    });
+    for (FsmAgent &agent : agents)
+      if (agent.enemy)
+        agent.action->action = move_towards(agent.pos, agent.enemyPos);
   }
 };
 
@@ -88,51 +104,24 @@ public:
   FleeFromEnemyState() {}
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity) const override
+  void act(float/* dt*/, flecs::world &/*ecs*/, std::span<FsmAgent> agents) const override
   {
-    on_closest_enemy_pos(ecs, entity, [&](Action &a, const Position &pos, const Position &enemy_pos)
-    {
-      a.action = inverse_move(move_towards(pos, enemy_pos));
-    });
+    for (FsmAgent &agent : agents)
+      if (agent.enemy)
+        agent.action->action = inverse_move(move_towards(agent.pos, agent.enemyPos));
   }
 };
 
-template<typename Callable>
-static void on_closest_ally_pos(flecs::world &ecs, flecs::entity entity, Callable c)
-{
-  static auto alliesQuery = ecs.query<const Position, const Team>();
-  entity.set([&](const Position &pos, const Team &t, Action &a)
-  {
-    flecs::entity closestAlly;
-    float closestDist = FLT_MAX;
-    Position closestPos;
-    alliesQuery.each([&](flecs::entity ally, const Position &epos, const Team &et)
-    {
-      if (t.team != et.team || entity == ally)
-        return;
-      float curDist = dist(epos, pos);
-      if (curDist < closestDist)
-      {
-        closestDist = curDist;
-        closestPos = epos;
-        closestAlly = ally;
-      }
-    });
-    if (ecs.is_valid(closestAlly))
-      c(a, pos, closestPos);
-  });
-}
-
 class FollowAllyState : public State
 {
 public:
   void enter() const override {}
   void exit() const override {}
-  void act(float /* dt*/, flecs::world &ecs, flecs::entity entity) const override {
-    on_closest_ally_pos(ecs, entity, [&](Action &a, const Position &pos, const Position &ally_pos)
-    {
-      a.action = move_towards(pos, ally_pos);
-    });
+  void act(float /* dt*/, flecs::world &/*ecs*/, std::span<FsmAgent> agents) const override
+  {
+    for (FsmAgent &agent : agents)
+      if (agent.ally)
+        agent.action->action = move_towards(agent.pos, agent.allyPos);
   }
 };
 
@@ -143,18 +132,19 @@ public:
   PatrolState(float dist) : patrolDist(dist) {}
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity) const override
+  void act(float/* dt*/, flecs::world &/*ecs*/, std::span<FsmAgent> agents) const override
   {
-    entity.set([&](const Position &pos, const PatrolPos &ppos, Action &a)
-    {
-      if (dist(pos, ppos) > patrolDist)
-        a.action = move_towards(pos, ppos); // do a recovery walk
-      else
+    for (FsmAgent &agent : agents)
+      agent.entity.get([&](const PatrolPos &ppos)
       {
-        // do a random walk
-        a.action = GetRandomValue(EA_MOVE_START, EA_MOVE_END - 1);
-      }
-    });
+        if (dist(agent.pos, ppos) > patrolDist)
+          agent.action->action = move_towards(agent.pos, ppos); // do a recovery walk
+        else
+        {
+          // do a random walk
+          agent.action->action = GetRandomValue(EA_MOVE_START, EA_MOVE_END - 1);
+        }
+      });
   }
 };
 
@@ -166,39 +156,15 @@ public:
   HealState(float _healAmount) : healAmount(_healAmount) {}
   void enter() const override {}
   void exit() const override {}
-  void act(float /* dt*/, flecs::world &ecs, flecs::entity entity) const override {
-    entity.set([&](Hitpoints &hp) {
-      hp.hitpoints = std::clamp(hp.hitpoints + healAmount, 0.0f, 100.0f);
-    });
+  void act(float /* dt*/, flecs::world &/*ecs*/, std::span<FsmAgent> agents) const override
+  {
+    for (FsmAgent &agent : agents)
+      agent.entity.set([&](Hitpoints &hp) {
+        hp.hitpoints = std::clamp(hp.hitpoints + healAmount, 0.0f, 100.0f);
+      });
   }
 };
 
-template<typename Callable>
-static void on_closest_ally(flecs::world &ecs, flecs::entity entity, Callable c)
-{
-  static auto alliesQuery = ecs.query<const Position, const Team>();
-  entity.set([&](const Position &pos, const Team &t, Action &a)
-  {
-    flecs::entity closestAlly;
-    float closestDist = FLT_MAX;
-    Position closestPos;
-    alliesQuery.each([&](flecs::entity ally, const Position &epos, const Team &et)
-    {
-      if (t.team != et.team || entity == ally)
-        return;
-      float curDist = dist(epos, pos);
-      if (curDist < closestDist)
-      {
-        closestDist = curDist;
-        closestPos = epos;
-        closestAlly = ally;
-      }
-    });
-    if (ecs.is_valid(closestAlly))
-      c(a, closestAlly);
-  });
-}
-
 class HealClosestAlly : public State
 {
 private:
@@ -207,19 +173,20 @@ public:
   HealClosestAlly(float _healAmount) : healAmount(_healAmount) {}
   void enter() const override {}
   void exit() const override {}
-  void act(float /* dt*/, flecs::world &ecs, flecs::entity entity) const override {
-    on_closest_ally(ecs, entity, [&](Action &a, flecs::entity closestAlly)
+  void act(float /* dt*/, flecs::world &/*ecs*/, std::span<FsmAgent> agents) const override
+  {
+    for (FsmAgent &agent : agents)
     {
-      closestAlly.set([&](Hitpoints &hp) {
-        hp.hitpoints += healAmount;
-      });
-    });
+      if (agent.ally)
+        agent.ally.set([&](Hitpoints &hp) {
+          hp.hitpoints += healAmount;
+        });
 
-    entity.set([](HealCooldown &cd)
-    {
-      printf("Set cur to 0\n");
-      cd.cur = 0;
-    });
+      agent.entity.set([](HealCooldown &cd)
+      {
+        cd.cur = 0;
+      });
+    }
   }
 };
 
@@ -228,109 +195,50 @@ class NopState : public State
 public:
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity) const override {}
+  void act(float/* dt*/, flecs::world &/*ecs*/, std::span<FsmAgent> /*agents*/) const override {}
 };
 
-class EnemyAvailableTransition : public StateTransition
+static bool is_enemy_available(float trigger_dist, const FsmAgent &agent)
 {
-  float triggerDist;
-public:
-  EnemyAvailableTransition(float in_dist) : triggerDist(in_dist) {}
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
-  {
-    static auto enemiesQuery = ecs.query<const Position, const Team>();
-    bool enemiesFound = false;
-    entity.get([&](const Position &pos, const Team &t)
-    {
-      enemiesQuery.each([&](flecs::entity enemy, const Position &epos, const Team &et)
-      {
-        if (t.team == et.team)
-          return;
-        float curDist = dist(epos, pos);
-        enemiesFound |= curDist <= triggerDist;
-      });
-    });
-    return enemiesFound;
-  }
-};
+  return agent.enemyDist <= trigger_dist;
+}
 
-class AllyAvailableTransition : public StateTransition
+static bool is_ally_available(float trigger_dist, const FsmAgent &agent)
 {
-  float triggerDist;
-public:
-  AllyAvailableTransition(float in_dist) : triggerDist(in_dist) {}
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
-  {
-    static auto alliesQuery = ecs.query<const Position, const Team>();
-    bool alliesFound = false;
-    entity.get([&](const Position &pos, const Team &t)
-    {
-      alliesQuery.each([&](flecs::entity ally, const Position &epos, const Team &et)
-      {
-        if (t.team != et.team || entity == ally)
-          return;
-        float curDist = dist(epos, pos);
-        alliesFound |= curDist <= triggerDist;
-      });
-    });
-    return alliesFound;
-  }
-};
+  return agent.allyDist <= trigger_dist;
+}
 
-class HealAvailableTransition : public StateTransition
+static bool is_heal_available(float /*param*/, const FsmAgent &agent)
 {
-public:
-  bool isAvailable(flecs::world &/*ecs*/, flecs::entity entity) const override
-  {
-    bool isAvailable = false;
-    entity.get([&](const HealCooldown &cd)
-    {
-      isAvailable |= cd.cur == cd.cooldown;
-    });
-    return isAvailable;
-  }
-};
+  return agent.healReady;
+}
 
-class HitpointsLessThanTransition : public StateTransition
+static bool is_hitpoints_less_than(float threshold, const FsmAgent &agent)
 {
-  float threshold;
-public:
-  HitpointsLessThanTransition(float in_thres) : threshold(in_thres) {}
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
-  {
-    bool hitpointsThresholdReached = false;
-    entity.get([&](const Hitpoints &hp)
-    {
-      hitpointsThresholdReached |= hp.hitpoints < threshold;
-    });
-    return hitpointsThresholdReached;
-  }
-};
+  return agent.hitpoints < threshold;
+}
 
-class ClosestAllyHitpointsLessThanTransition : public StateTransition
+static bool is_closest_ally_hitpoints_less_than(float threshold, const FsmAgent &agent)
 {
-  float threshold;
-public:
-  ClosestAllyHitpointsLessThanTransition(float thres) : threshold(thres) {}
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
-  {
-    bool hitpointsThresholdReached = false;
-    on_closest_ally(ecs, entity, [&](Action &a, flecs::entity closestAlly)
-    {
-      closestAlly.get([&](const Hitpoints &hp) {
-        hitpointsThresholdReached |= hp.hitpoints < threshold;
-      });
-    });
-    return hitpointsThresholdReached;
-  }
-};
+  return agent.ally && agent.allyHitpoints < threshold;
+}
 
-class EnemyReachableTransition : public StateTransition
+static bool is_enemy_reachable(float /*param*/, const FsmAgent &/*agent*/)
 {
+  return false;
+}
+
+// leaf condition, a single predicate call
+class PredicateTransition : public StateTransition
+{
+  TransitionPredicate pred;
+  float param;
 public:
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
+  PredicateTransition(TransitionPredicate in_pred, float in_param = 0.f) : pred(in_pred), param(in_param) {}
+
+  void compile(std::vector<TransitionOp> &ops) const override
   {
-    return false;
+    ops.push_back({TO_TEST, 0, param, pred});
   }
 };
 
@@ -341,12 +249,24 @@ public:
   NegateTransition(const StateTransition *in_trans) : transition(in_trans) {}
   ~NegateTransition() override { delete transition; }
 
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
+  void compile(std::vector<TransitionOp> &ops) const override
   {
-    return !transition->isAvailable(ecs, entity);
+    transition->compile(ops);
+    ops.push_back({TO_NOT});
   }
 };
 
+// rhs is skipped when lhs already decides the result
+static void compile_short_circuit(std::vector<TransitionOp> &ops, const StateTransition *lhs,
+                                  const StateTransition *rhs, TransitionOpCode skip_code)
+{
+  lhs->compile(ops);
+  const size_t skipIdx = ops.size();
+  ops.push_back({skip_code});
+  rhs->compile(ops);
+  ops[skipIdx].skip = int(ops.size() - skipIdx - 1);
+}
+
 class AndTransition : public StateTransition
 {
   const StateTransition *lhs; // we own it
@@ -359,9 +279,9 @@ public:
     delete rhs;
   }
 
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
+  void compile(std::vector<TransitionOp> &ops) const override
   {
-    return lhs->isAvailable(ecs, entity) && rhs->isAvailable(ecs, entity);
+    compile_short_circuit(ops, lhs, rhs, TO_SKIP_IF_FALSE);
   }
 };
 
@@ -377,9 +297,9 @@ public:
     delete rhs;
   }
 
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
+  void compile(std::vector<TransitionOp> &ops) const override
   {
-    return lhs->isAvailable(ecs, entity) || rhs->isAvailable(ecs, entity);
+    compile_short_circuit(ops, lhs, rhs, TO_SKIP_IF_TRUE);
   }
 };
 
@@ -427,32 +347,32 @@ State *create_nop_state()
 // transitions
 StateTransition *create_enemy_available_transition(float dist)
 {
-  return new EnemyAvailableTransition(dist);
+  return new PredicateTransition(&is_enemy_available, dist);
 }
 
 StateTransition *create_ally_available_transition(float dist)
 {
-  return new AllyAvailableTransition(dist);
+  return new PredicateTransition(&is_ally_available, dist);
 }
 
 StateTransition *create_enemy_reachable_transition()
 {
-  return new EnemyReachableTransition();
+  return new PredicateTransition(&is_enemy_reachable);
 }
 
 StateTransition *create_heal_available_transition()
 {
-  return new HealAvailableTransition();
+  return new PredicateTransition(&is_heal_available);
 }
 
 StateTransition *create_hitpoints_less_than_transition(float thres)
 {
-  return new HitpointsLessThanTransition(thres);
+  return new PredicateTransition(&is_hitpoints_less_than, thres);
 }
 
 StateTransition *create_closest_ally_hitpoints_less_than_transition(float thres)
 {
-  return new ClosestAllyHitpointsLessThanTransition(thres);
+  return new PredicateTransition(&is_closest_ally_hitpoints_less_than, thres);
 }
 
 StateTransition *create_negate_transition(StateTransition *in)
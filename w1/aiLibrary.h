@@ -2,6 +2,9 @@
 
 #include "stateMachine.h"
 
+// sensors of every agent running a state machine, all of them are read once per turn
+void gather_fsm_agents(flecs::world &ecs, std::vector<FsmAgent> &agents);
+
 // states
 State *create_attack_enemy_state();
 State *create_move_to_enemy_state();
@@ -3,10 +3,20 @@
 #include "raylib.h"
 #include "stateMachine.h"
 #include "aiLibrary.h"
+#include "spatialHash.h"
+
+// machines are built once, the first time an entity needs them
+template<typename Builder>
+static StateMachineHandle build_state_machine(Builder build)
+{
+  const StateMachineHandle handle = create_state_machine_def();
+  build(get_state_machine_def(handle));
+  return handle;
+}
 
 static void add_patrol_attack_flee_sm(flecs::entity entity)
 {
-  entity.get([](StateMachine &sm)
+  static const StateMachineHandle def = build_state_machine([](StateMachineDef &sm)
   {
     int patrol = sm.addState(create_patrol_state(3.f));
     int moveToEnemy = sm.addState(create_move_to_enemy_state());
@@ -22,6 +32,7 @@ static void add_patrol_attack_flee_sm(flecs::entity entity)
 
     sm.addTransition(create_negate_transition(create_enemy_available_transition(7.f)), fleeFromEnemy, patrol);
   });
+  entity.set(StateMachine{def});
 }
 
 static void add_healer_swordsman_sm(flecs::entity entity, int heal_cooldown = 10)
@@ -32,7 +43,7 @@ static void add_healer_swordsman_sm(flecs::entity entity, int heal_cooldown = 10
     cd.cur = heal_cooldown;
   });
 
-  entity.get([](StateMachine &sm)
+  static const StateMachineHandle def = build_state_machine([](StateMachineDef &sm)
   {
     int moveToEnemy = sm.addState(create_move_to_enemy_state());
     int followAlly = sm.addState(create_follow_ally_state());
@@ -46,11 +57,12 @@ static void add_healer_swordsman_sm(flecs::entity entity, int heal_cooldown = 10
 
     sm.addTransition(create_negate_transition(create_heal_available_transition()), healAlly, followAlly);
   });
+  entity.set(StateMachine{def});
 }
 
 static void add_patrol_flee_sm(flecs::entity entity)
 {
-  entity.get([](StateMachine &sm)
+  static const StateMachineHandle def = build_state_machine([](StateMachineDef &sm)
   {
     int patrol = sm.addState(create_patrol_state(3.f));
     int fleeFromEnemy = sm.addState(create_flee_from_enemy_state());
@@ -58,19 +70,21 @@ static void add_patrol_flee_sm(flecs::entity entity)
     sm.addTransition(create_enemy_available_transition(3.f), patrol, fleeFromEnemy);
     sm.addTransition(create_negate_transition(create_enemy_available_transition(5.f)), fleeFromEnemy, patrol);
   });
+  entity.set(StateMachine{def});
 }
 
 static void add_attack_sm(flecs::entity entity)
 {
-  entity.get([](StateMachine &sm)
+  static const StateMachineHandle def = build_state_machine([](StateMachineDef &sm)
   {
     sm.addState(create_move_to_enemy_state());
   });
+  entity.set(StateMachine{def});
 }
 
 static void add_berserk_sm(flecs::entity entity)
 {
-  entity.get([](StateMachine &sm)
+  static const StateMachineHandle def = build_state_machine([](StateMachineDef &sm)
   {
     int patrol = sm.addState(create_patrol_state(3.f));
     int moveToEnemy = sm.addState(create_move_to_enemy_state());
@@ -82,11 +96,12 @@ static void add_berserk_sm(flecs::entity entity)
     sm.addTransition(create_hitpoints_less_than_transition(60.f), patrol, moveToEnemyBerserk);
     sm.addTransition(create_hitpoints_less_than_transition(60.f), moveToEnemy, moveToEnemyBerserk);
   });
+  entity.set(StateMachine{def});
 }
 
 static void add_healer_sm(flecs::entity entity)
 {
-  entity.get([](StateMachine &sm)
+  static const StateMachineHandle def = build_state_machine([](StateMachineDef &sm)
   {
     int patrol = sm.addState(create_patrol_state(3.f));
     int moveToEnemy = sm.addState(create_move_to_enemy_state());
@@ -106,6 +121,7 @@ static void add_healer_sm(flecs::entity entity)
                             create_negate_transition(create_enemy_available_transition(5.f))),
                             healState, patrol);
   });
+  entity.set(StateMachine{def});
 }
 
 static flecs::entity create_monster(flecs::world &ecs, int x, int y, Color color)
@@ -230,6 +246,8 @@ void init_roguelike(flecs::world &ecs)
 
   create_heal(ecs, -5, -5, 50.f);
   create_heal(ecs, -5, 5, 50.f);
+
+  get_spatial_hash().rebuild(ecs);
 }
 
 static bool is_player_acted(flecs::world &ecs)
@@ -345,11 +363,13 @@ static void process_actions(flecs::world &ecs)
       });
     });
   });
+  // everyone has moved, sensors of the next turn query the new positions
+  get_spatial_hash().rebuild(ecs);
 }
 
 void process_turn(flecs::world &ecs)
 {
-  static auto stateMachineAct = ecs.query<StateMachine>();
+  static std::vector<FsmAgent> fsmAgents;
   if (is_player_acted(ecs))
   {
     if (upd_player_actions_count(ecs))
@@ -357,10 +377,8 @@ void process_turn(flecs::world &ecs)
       // Plan action for NPCs
       ecs.defer([&]
       {
-        stateMachineAct.each([&](flecs::entity e, StateMachine &sm)
-        {
-          sm.act(0.f, ecs, e);
-        });
+        gather_fsm_agents(ecs, fsmAgents);
+        act_state_machines(0.f, ecs, fsmAgents);
       });
       update_ai_timers(ecs);
     }
@@ -1,44 +1,131 @@
 #include "stateMachine.h"
+#include <algorithm>
+#include <deque>
 
-StateMachine::~StateMachine()
+static std::deque<StateMachineDef> stateMachineDefs; // deque keeps references valid
+
+StateMachineHandle create_state_machine_def()
+{
+  stateMachineDefs.emplace_back();
+  return StateMachineHandle(stateMachineDefs.size() - 1);
+}
+
+StateMachineDef &get_state_machine_def(StateMachineHandle handle)
+{
+  return stateMachineDefs[size_t(handle)];
+}
+
+StateMachineDef::~StateMachineDef()
 {
   for (State* state : states)
     delete state;
   states.clear();
-  for (auto &transList : transitions)
-    for (auto &transition : transList)
-      delete transition.first;
-  transitions.clear();
 }
 
-void StateMachine::act(float dt, flecs::world &ecs, flecs::entity entity)
+static bool run_condition(const TransitionOp *op, const TransitionOp *end, const FsmAgent &agent)
 {
-  if (curStateIdx < states.size())
+  bool res = false;
+  for (; op < end; ++op)
   {
-    for (const auto [transition, destStateIdx] : transitions[curStateIdx])
-      if (transition->isAvailable(ecs, entity))
+    switch (op->code)
+    {
+      case TO_TEST: res = op->pred(op->param, agent); break;
+      case TO_NOT: res = !res; break;
+      case TO_SKIP_IF_FALSE: if (!res) op += op->skip; break;
+      case TO_SKIP_IF_TRUE: if (res) op += op->skip; break;
+    }
+  }
+  return res;
+}
+
+void StateMachineDef::transit(std::span<FsmAgent> agents) const
+{
+  if (agents.empty())
+    return;
+  const int state = agents.front().sm->curStateIdx;
+  for (FsmAgent &agent : agents)
+    for (int i = firstTransition[size_t(state)]; i < firstTransition[size_t(state + 1)]; ++i)
+    {
+      const Transition &transition = transitions[size_t(i)];
+      const TransitionOp *code = ops.data() + transition.firstOp;
+      if (run_condition(code, code + transition.numOps, agent))
       {
-        states[curStateIdx]->exit();
-        curStateIdx = destStateIdx;
-        states[curStateIdx]->enter();
+        states[size_t(state)]->exit();
+        agent.sm->curStateIdx = transition.to;
+        states[size_t(transition.to)]->enter();
         break;
       }
-    states[curStateIdx]->act(dt, ecs, entity);
-  }
-  else
-    curStateIdx = 0;
+    }
+}
+
+void StateMachineDef::act(int state, float dt, flecs::world &ecs, std::span<FsmAgent> agents) const
+{
+  states[size_t(state)]->act(dt, ecs, agents);
 }
 
-int StateMachine::addState(State *st)
+int StateMachineDef::addState(State *st)
 {
   int idx = states.size();
   states.push_back(st);
-  transitions.push_back(std::vector<std::pair<StateTransition*, int>>());
+  firstTransition.push_back(int(transitions.size()));
   return idx;
 }
 
-void StateMachine::addTransition(StateTransition *trans, int from, int to)
+void StateMachineDef::addTransition(StateTransition *trans, int from, int to)
+{
+  const int firstOp = int(ops.size());
+  trans->compile(ops);
+  delete trans;
+  auto itf = std::upper_bound(transitions.begin(), transitions.end(), from,
+                              [](int st, const Transition &rhs) { return st < rhs.from; });
+  transitions.insert(itf, Transition{from, to, firstOp, int(ops.size()) - firstOp});
+  for (size_t i = size_t(from + 1); i < firstTransition.size(); ++i)
+    firstTransition[i]++;
+}
+
+static bool state_less(const FsmAgent &lhs, const FsmAgent &rhs)
+{
+  if (lhs.sm->def != rhs.sm->def)
+    return lhs.sm->def < rhs.sm->def;
+  return lhs.sm->curStateIdx < rhs.sm->curStateIdx;
+}
+
+// agents keep their relative order inside a group
+template<typename Callable>
+static void for_each_state_group(std::vector<FsmAgent> &agents, Callable c)
 {
-  transitions[from].push_back(std::make_pair(trans, to));
+  std::stable_sort(agents.begin(), agents.end(), state_less);
+  for (size_t first = 0; first < agents.size();)
+  {
+    size_t last = first + 1;
+    while (last < agents.size() && !state_less(agents[first], agents[last]))
+      ++last;
+    const StateMachine &sm = *agents[first].sm;
+    c(get_state_machine_def(sm.def), sm.curStateIdx, std::span<FsmAgent>(agents).subspan(first, last - first));
+    first = last;
+  }
 }
 
+void act_state_machines(float dt, flecs::world &ecs, std::vector<FsmAgent> &agents)
+{
+  std::erase_if(agents, [](const FsmAgent &agent)
+  {
+    if (agent.sm->def < 0)
+      return true;
+    if (agent.sm->curStateIdx >= get_state_machine_def(agent.sm->def).numStates())
+    {
+      agent.sm->curStateIdx = 0;
+      return true;
+    }
+    return false;
+  });
+  for_each_state_group(agents, [](const StateMachineDef &def, int, std::span<FsmAgent> group)
+  {
+    def.transit(group);
+  });
+  // transitions moved agents, so groups are rebuilt for the states they act in
+  for_each_state_group(agents, [&](const StateMachineDef &def, int state, std::span<FsmAgent> group)
+  {
+    def.act(state, dt, ecs, group);
+  });
+}
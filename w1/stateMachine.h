@@ -1,6 +1,34 @@
 #pragma once
 #include <vector>
+#include <span>
+#include <cfloat>
+#include <cstdint>
 #include <flecs.h>
+#include "ecsTypes.h"
+
+struct StateMachine;
+
+// An agent as seen by its state machine, sensors are gathered once per turn
+// so transitions and states don't query the world themselves
+struct FsmAgent
+{
+  flecs::entity entity;
+  StateMachine *sm = nullptr;
+  Action *action = nullptr;
+
+  Position pos;
+  float hitpoints = 0.f;
+  bool healReady = false;
+
+  flecs::entity enemy; // closest one, empty if there's none
+  Position enemyPos;
+  float enemyDist = FLT_MAX;
+
+  flecs::entity ally; // closest one, empty if there's none
+  Position allyPos;
+  float allyDist = FLT_MAX;
+  float allyHitpoints = 0.f;
+};
 
 class State
 {
@@ -8,35 +36,85 @@ public:
   virtual ~State() {}
   virtual void enter() const = 0;
   virtual void exit() const = 0;
-  virtual void act(float dt, flecs::world &ecs, flecs::entity entity) const = 0;
+  // all agents currently in this state of the machine at once
+  virtual void act(float dt, flecs::world &ecs, std::span<FsmAgent> agents) const = 0;
+};
+
+using TransitionPredicate = bool (*)(float param, const FsmAgent &agent);
+
+enum TransitionOpCode : uint8_t
+{
+  TO_TEST = 0, // result = pred(param)
+  TO_NOT,
+  TO_SKIP_IF_FALSE, // short circuits of and/or, skip the next ops
+  TO_SKIP_IF_TRUE
+};
+
+// Transition conditions are lowered to a flat list of ops run by a single loop,
+// the result of the last op is the only register
+struct TransitionOp
+{
+  TransitionOpCode code = TO_TEST;
+  int skip = 0;
+  float param = 0.f;
+  TransitionPredicate pred = nullptr;
 };
 
 class StateTransition
 {
 public:
   virtual ~StateTransition() {}
-  virtual bool isAvailable(flecs::world &ecs, flecs::entity entity) const = 0;
+  // appends ops computing the condition
+  virtual void compile(std::vector<TransitionOp> &ops) const = 0;
 };
 
-class StateMachine
+// Immutable once built, one definition is shared by every entity running it
+class StateMachineDef
 {
-  int curStateIdx = 0;
+  struct Transition
+  {
+    int from;
+    int to;
+    int firstOp;
+    int numOps;
+  };
+
   std::vector<State*> states;
-  std::vector<std::vector<std::pair<StateTransition*, int>>> transitions;
+  std::vector<Transition> transitions; // sorted by source state, in the order they were added
+  std::vector<int> firstTransition = {0}; // per state and one past the last
+  std::vector<TransitionOp> ops;
 public:
-  StateMachine() = default;
-  StateMachine(const StateMachine &sm) = default;
-  StateMachine(StateMachine &&sm) = default;
+  StateMachineDef() = default;
+  // owns the states
+  StateMachineDef(const StateMachineDef &) = delete;
+  StateMachineDef &operator=(const StateMachineDef &) = delete;
 
-  ~StateMachine();
+  ~StateMachineDef();
 
-  StateMachine &operator=(const StateMachine &sm) = default;
-  StateMachine &operator=(StateMachine &&sm) = default;
-
-
-  void act(float dt, flecs::world &ecs, flecs::entity entity);
+  // agents all have to be in the same valid state
+  void transit(std::span<FsmAgent> agents) const;
+  void act(int state, float dt, flecs::world &ecs, std::span<FsmAgent> agents) const;
+  int numStates() const { return int(states.size()); }
 
   int addState(State *st);
+  // the transition is compiled and deleted right away
   void addTransition(StateTransition *trans, int from, int to);
 };
 
+using StateMachineHandle = int;
+
+// definitions are kept for the lifetime of the program and referenced by handle
+StateMachineHandle create_state_machine_def();
+StateMachineDef &get_state_machine_def(StateMachineHandle handle);
+
+// per entity part, the machine it runs and its current state
+struct StateMachine
+{
+  StateMachineHandle def = -1;
+  int curStateIdx = 0;
+};
+
+// Agents are grouped by machine and state, each group runs its transitions and then its state as a batch.
+// Reorders the agents.
+void act_state_machines(float dt, flecs::world &ecs, std::vector<FsmAgent> &agents);
+
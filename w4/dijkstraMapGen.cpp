@@ -1,24 +1,9 @@
 #include "dijkstraMapGen.h"
 #include "ecsTypes.h"
 #include "dungeonUtils.h"
+#include <queue>
 #include "aiUtils.h"
 
-template<typename Callable>
-static void query_dungeon_data(flecs::world &ecs, Callable c)
-{
-  static auto dungeonDataQuery = ecs.query<const DungeonData>();
-
-  dungeonDataQuery.each(c);
-}
-
-template<typename Callable>
-static void query_characters_positions(flecs::world &ecs, Callable c)
-{
-  static auto characterPositionQuery = ecs.query<const Position, const Team>();
-
-  characterPositionQuery.each(c);
-}
-
 constexpr float invalid_tile_value = 1e5f;
 
 static void init_tiles(std::vector<float> &map, const DungeonData &dd)
@@ -67,118 +52,237 @@ static void process_dmap(std::vector<float> &map, const DungeonData &dd)
   }
 }
 
-void dmaps::gen_player_approach_map(flecs::world &ecs, std::vector<float> &map)
+void dmaps::scan_dmap(const DungeonData &dd, std::vector<float> &map)
 {
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
-  {
-    init_tiles(map, dd);
-    query_characters_positions(ecs, [&](const Position &pos, const Team &t)
-    {
-      if (t.team == 0) // player team hardcode
-        map[pos.y * dd.width + pos.x] = 0.f;
-    });
-    process_dmap(map, dd);
-  });
+  process_dmap(map, dd);
 }
 
-void dmaps::gen_player_flee_map(flecs::world &ecs, std::vector<float> &map)
+void dmaps::gen_player_approach_map(const DungeonData &dd, const std::vector<Position> &players, std::vector<float> &map)
 {
-  gen_player_approach_map(ecs, map);
-  for (float &v : map)
-    if (v < invalid_tile_value)
-      v *= -1.2f;
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
-  {
-    process_dmap(map, dd);
-  });
+  init_tiles(map, dd);
+  for (const Position &pos : players)
+    map[pos.y * dd.width + pos.x] = 0.f;
+  process_dmap(map, dd);
 }
 
-void dmaps::gen_hive_pack_map(flecs::world &ecs, std::vector<float> &map)
+void dmaps::gen_player_flee_map(const DungeonData &dd, const std::vector<Position> &players, std::vector<float> &map)
 {
-  static auto hiveQuery = ecs.query<const Position, const Hive>();
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
+  std::vector<float> approachMap;
+  gen_player_approach_map(dd, players, approachMap);
+  gen_player_flee_map(dd, approachMap, map);
+}
+
+// scaled approach values are the seeds of a single Dijkstra pass, no second scan over the whole map
+void dmaps::gen_player_flee_map(const DungeonData &dd, const std::vector<float> &approach_map, std::vector<float> &map)
+{
+  using QueueItem = std::pair<float, size_t>;
+  std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem>> queue;
+  init_tiles(map, dd);
+  for (size_t i = 0; i < approach_map.size(); ++i)
+    if (approach_map[i] < invalid_tile_value)
+    {
+      map[i] = approach_map[i] * -1.2f;
+      queue.push({map[i], i});
+    }
+  while (!queue.empty())
   {
-    init_tiles(map, dd);
-    hiveQuery.each([&](const Position &pos, const Hive &)
+    const auto [dist, idx] = queue.top();
+    queue.pop();
+    if (dist > map[idx])
+      continue; // stale entry, the tile was already reached cheaper
+    const size_t x = idx % dd.width;
+    const size_t y = idx / dd.width;
+    auto relax = [&](size_t nx, size_t ny)
     {
-      map[pos.y * dd.width + pos.x] = 0.f;
-    });
-    process_dmap(map, dd);
-  });
+      const size_t nidx = ny * dd.width + nx;
+      if (nx < dd.width && ny < dd.height && dd.tiles[nidx] == dungeon::floor && dist + 1.f < map[nidx])
+      {
+        map[nidx] = dist + 1.f;
+        queue.push({map[nidx], nidx});
+      }
+    };
+    relax(x - 1, y + 0);
+    relax(x + 1, y + 0);
+    relax(x + 0, y - 1);
+    relax(x + 0, y + 1);
+  }
 }
 
-void dmaps::gen_exploration_map(flecs::world &ecs, std::vector<float> &map)
+void dmaps::gen_hive_pack_map(const DungeonData &dd, const std::vector<Position> &hives, std::vector<float> &map)
 {
-  static auto explorationQuery = ecs.query<const ExplorationData>();
-  query_dungeon_data(ecs, [&](const DungeonData &dd) {
-    init_tiles(map, dd);
-    explorationQuery.each([&](const ExplorationData &data) {
-      for (int y = 0; y < data.height; ++y)
-        for (int x = 0; x < data.width; ++x)
-        {
-          if (dd.tiles[data.width * y + x] != dungeon::wall && !data.data[data.width * y + x])
-            map[dd.width * y + x] = 0.f;
-        }
-    });
-    process_dmap(map, dd);
-  });
+  init_tiles(map, dd);
+  for (const Position &pos : hives)
+    map[pos.y * dd.width + pos.x] = 0.f;
+  process_dmap(map, dd);
 }
 
-void dmaps::gen_ally_map(flecs::world &ecs, std::vector<float> &map, flecs::entity e, const Team &t)
+void dmaps::gen_exploration_map(const DungeonData &dd, const ExplorationData &data, std::vector<float> &map)
 {
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
+  init_tiles(map, dd);
+  // every path from explored tiles to unexplored ones goes through the frontier,
+  // so seeding it and flooding explored tiles gives the same values where explorers walk
+  std::vector<size_t> queue;
+  queue.reserve(data.frontier.size());
+  for (size_t idx : data.frontier)
   {
-    init_tiles(map, dd);
-    query_characters_positions(ecs, [&](flecs::entity ee, const Position &epos, const Team &et) {
-      if (et.team == t.team && ee != e)
+    map[idx] = 0.f;
+    queue.push_back(idx);
+  }
+  for (size_t head = 0; head < queue.size(); ++head)
+  {
+    const size_t idx = queue[head];
+    const float nextVal = map[idx] + 1.f;
+    const size_t x = idx % dd.width;
+    const size_t y = idx / dd.width;
+    auto push_nei = [&](size_t nx, size_t ny)
+    {
+      const size_t nidx = ny * dd.width + nx;
+      if (nx < dd.width && ny < dd.height && dd.tiles[nidx] == dungeon::floor && data.explored.test(nidx)
+          && nextVal < map[nidx])
       {
-        map[epos.y * dd.width + epos.x] = 0.f;
+        map[nidx] = nextVal;
+        queue.push_back(nidx);
       }
-    });
-    process_dmap(map, dd);
-  });
+    };
+    push_nei(x - 1, y + 0);
+    push_nei(x + 1, y + 0);
+    push_nei(x + 0, y - 1);
+    push_nei(x + 0, y + 1);
+  }
+}
+
+// BFS that keeps two labels per tile, a tile is expanded once per each of its two nearest sources
+void dmaps::gen_ally_label_map(const DungeonData &dd, const std::vector<std::pair<Position, uint64_t>> &allies,
+                               DijkstraLabelMapData &map)
+{
+  struct Front
+  {
+    size_t idx;
+    uint64_t source;
+    float dist;
+  };
+  map.best.assign(dd.width * dd.height, DijkstraLabelMapData::Label{});
+  map.second.assign(dd.width * dd.height, DijkstraLabelMapData::Label{});
+
+  std::vector<Front> queue;
+  queue.reserve(2 * dd.width * dd.height);
+  for (const auto &[pos, source] : allies)
+    queue.push_back({size_t(pos.y) * dd.width + size_t(pos.x), source, 0.f});
+
+  for (size_t head = 0; head < queue.size(); ++head)
+  {
+    const Front cur = queue[head];
+    DijkstraLabelMapData::Label &best = map.best[cur.idx];
+    DijkstraLabelMapData::Label &second = map.second[cur.idx];
+    if (best.source == cur.source || second.source == cur.source)
+      continue;
+    if (best.source == 0)
+      best = {cur.dist, cur.source};
+    else if (second.source == 0)
+      second = {cur.dist, cur.source};
+    else
+      continue;
+
+    const size_t x = cur.idx % dd.width;
+    const size_t y = cur.idx / dd.width;
+    auto push_nei = [&](size_t nx, size_t ny)
+    {
+      if (nx < dd.width && ny < dd.height && dd.tiles[ny * dd.width + nx] == dungeon::floor)
+        queue.push_back({ny * dd.width + nx, cur.source, cur.dist + 1.f});
+    };
+    push_nei(x - 1, y + 0);
+    push_nei(x + 1, y + 0);
+    push_nei(x + 0, y - 1);
+    push_nei(x + 0, y + 1);
+  }
 }
 
-void dmaps::gen_mage_approach_map(flecs::world &ecs, std::vector<float> &map)
+std::vector<Position> dmaps::gen_mage_approach_seeds(const DungeonData &dd, const Position &pos)
 {
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
+  const int dist = mage_seed_dist;
+  std::vector<Position> seeds;
+  for (int i = -dist; i <= dist; ++i)
   {
-    init_tiles(map, dd);
-    query_characters_positions(ecs, [&](const Position &pos, const Team &t) {
-      if (t.team == 0) // player team hardcode
+    for (int j = -dist; j <= dist; ++j)
+    {
+      if (i == -dist || i == dist || j == -dist || j == dist)
       {
-        const int dist = 4;
-        for (int i = -dist; i <= dist; ++i)
+        auto moveCount = 0;
+        auto curPos = pos;
+        auto prevPos = curPos;
+        while (curPos.x >= 0 && curPos.x < dd.width
+               && curPos.y >= 0 && curPos.y < dd.height
+               && !(curPos.x == pos.x + i && curPos.y == pos.y + j)
+               && dd.tiles[dd.width * curPos.y + curPos.x] != dungeon::wall
+               && moveCount <= 4)
         {
-          for (int j = -dist; j <= dist; ++j)
-          {
-            if (i == -dist || i == dist || j == -dist || j == dist)
-            {
-              auto moveCount = 0;
-              auto curPos = pos;
-              auto prevPos = curPos;
-              while (curPos.x >= 0 && curPos.x < dd.width
-                     && curPos.y >= 0 && curPos.y < dd.height
-                     && !(curPos.x == pos.x + i && curPos.y == pos.y + j)
-                     && dd.tiles[dd.width * curPos.y + curPos.x] != dungeon::wall
-                     && moveCount <= 4)
-              {
-                prevPos = curPos;
-                curPos = move_pos(curPos, move_towards(curPos, Position{pos.x + i, pos.y + j}));
-                ++moveCount;
-              }
-              if (dd.tiles[dd.width * curPos.y + curPos.x] != dungeon::wall
-                  || !(curPos.x >= 0 && curPos.x < dd.width)
-                  || !(curPos.y >= 0 && curPos.y < dd.height))
-                curPos = prevPos;
-
-              map[dd.width * curPos.y + curPos.x] = 0.f;
-            }
-          }
+          prevPos = curPos;
+          curPos = move_pos(curPos, move_towards(curPos, Position{pos.x + i, pos.y + j}));
+          ++moveCount;
         }
+        if (dd.tiles[dd.width * curPos.y + curPos.x] != dungeon::wall
+            || !(curPos.x >= 0 && curPos.x < dd.width)
+            || !(curPos.y >= 0 && curPos.y < dd.height))
+          curPos = prevPos;
+        seeds.push_back(curPos);
       }
-    });
-    process_dmap(map, dd);
-  });
+    }
+  }
+  return seeds;
 }
 
+void dmaps::gen_mage_approach_map(const DungeonData &dd, const std::vector<Position> &players, int radius,
+                                  DijkstraMapData &map)
+{
+  radius = std::max(radius, mage_seed_dist + 1); // seeds are up to five moves away from the player
+  map.windowed = true;
+  map.width = dd.width;
+  map.height = dd.height;
+  map.windows.clear();
+  for (const Position &pos : players)
+  {
+    DijkstraMapData::Window &window = map.windows.emplace_back();
+    window.x = pos.x - radius;
+    window.y = pos.y - radius;
+    window.size = 2 * radius + 1;
+    window.values.assign(size_t(window.size * window.size), invalid_tile_value);
+    auto is_floor = [&](int x, int y)
+    {
+      return x >= 0 && y >= 0 && x < int(dd.width) && y < int(dd.height)
+             && dd.tiles[dd.width * size_t(y) + size_t(x)] == dungeon::floor;
+    };
+    auto local_idx = [&](int x, int y) { return size_t((y - window.y) * window.size + (x - window.x)); };
+
+    // BFS limited to the window, queue holds map positions
+    std::vector<Position> queue;
+    for (const Position &seedPos : gen_mage_approach_seeds(dd, pos))
+    {
+      float &seed = window.values[local_idx(seedPos.x, seedPos.y)];
+      if (seed == 0.f)
+        continue;
+      seed = 0.f;
+      if (is_floor(seedPos.x, seedPos.y))
+        queue.push_back(seedPos);
+    }
+    for (size_t head = 0; head < queue.size(); ++head)
+    {
+      const Position cur = queue[head];
+      const float nextVal = window.values[local_idx(cur.x, cur.y)] + 1.f;
+      auto push_nei = [&](int x, int y)
+      {
+        if (x < window.x || y < window.y || x >= window.x + window.size || y >= window.y + window.size
+            || !is_floor(x, y))
+          return;
+        float &v = window.values[local_idx(x, y)];
+        if (v <= nextVal)
+          return;
+        v = nextVal;
+        queue.push_back(Position{x, y});
+      };
+      push_nei(cur.x - 1, cur.y + 0);
+      push_nei(cur.x + 1, cur.y + 0);
+      push_nei(cur.x + 0, cur.y - 1);
+      push_nei(cur.x + 0, cur.y + 1);
+    }
+  }
+}
@@ -1,15 +1,29 @@
 #pragma once
 #include <vector>
-#include <flecs.h>
+#include <utility>
 #include "ecsTypes.h"
 
+// Generators only read the dungeon and the source data gathered by the caller,
+// so they don't touch the ecs and can be run from worker threads.
 namespace dmaps
 {
-  void gen_player_approach_map(flecs::world &ecs, std::vector<float> &map);
-  void gen_player_flee_map(flecs::world &ecs, std::vector<float> &map);
-  void gen_hive_pack_map(flecs::world &ecs, std::vector<float> &map);
-  void gen_exploration_map(flecs::world &ecs, std::vector<float> &map);
-  void gen_ally_map(flecs::world &ecs, std::vector<float> &map, flecs::entity e, const Team &t);
-  void gen_mage_approach_map(flecs::world &ecs, std::vector<float> &map);
+  // plain scan relaxation of an already seeded map, reference for the faster generators
+  void scan_dmap(const DungeonData &dd, std::vector<float> &map);
+
+  void gen_player_approach_map(const DungeonData &dd, const std::vector<Position> &players, std::vector<float> &map);
+  void gen_player_flee_map(const DungeonData &dd, const std::vector<Position> &players, std::vector<float> &map);
+  // same flee map built from an already generated approach map
+  void gen_player_flee_map(const DungeonData &dd, const std::vector<float> &approach_map, std::vector<float> &map);
+  void gen_hive_pack_map(const DungeonData &dd, const std::vector<Position> &hives, std::vector<float> &map);
+  void gen_exploration_map(const DungeonData &dd, const ExplorationData &data, std::vector<float> &map);
+  // single map for the whole team, every ally reads it excluding itself
+  void gen_ally_label_map(const DungeonData &dd, const std::vector<std::pair<Position, uint64_t>> &allies,
+                          DijkstraLabelMapData &map);
+  // seeds of the mage map, tiles reached by walking up to mage_seed_dist moves towards a ring around the player
+  constexpr int mage_seed_dist = 4;
+  std::vector<Position> gen_mage_approach_seeds(const DungeonData &dd, const Position &pos);
+  // windowed map, distances are only computed in a square of the given radius around every player
+  void gen_mage_approach_map(const DungeonData &dd, const std::vector<Position> &players, int radius,
+                             DijkstraMapData &map);
 };
 
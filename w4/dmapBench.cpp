@@ -0,0 +1,351 @@
+#include "dmapBench.h"
+#include "dijkstraMapGen.h"
+#include "dungeonGen.h"
+#include "dungeonUtils.h"
+#include "dmapJobs.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <deque>
+
+constexpr float invalid_tile_value = 1e5f;
+
+template<typename Callable>
+static double time_ms(int iterations, Callable fn)
+{
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    fn();
+  const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / double(iterations);
+}
+
+static std::vector<Position> pick_floor_tiles(const DungeonData &dd, size_t count, std::default_random_engine &rng)
+{
+  std::vector<Position> floorTiles;
+  for (size_t y = 0; y < dd.height; ++y)
+    for (size_t x = 0; x < dd.width; ++x)
+      if (dd.tiles[y * dd.width + x] == dungeon::floor)
+        floorTiles.push_back(Position{int(x), int(y)});
+  std::uniform_int_distribution<size_t> dist(0, floorTiles.size() - 1);
+  std::vector<Position> res;
+  for (size_t i = 0; i < count; ++i)
+    res.push_back(floorTiles[dist(rng)]);
+  return res;
+}
+
+static std::vector<float> seeded_map(const DungeonData &dd, const std::vector<Position> &seeds)
+{
+  std::vector<float> map(dd.width * dd.height, invalid_tile_value);
+  for (const Position &pos : seeds)
+    map[size_t(pos.y) * dd.width + size_t(pos.x)] = 0.f;
+  return map;
+}
+
+// plain BFS from the seeds, reference for the scan generators
+static std::vector<float> bfs_map(const DungeonData &dd, const std::vector<Position> &seeds)
+{
+  std::vector<float> map = seeded_map(dd, seeds);
+  std::deque<size_t> queue;
+  for (const Position &pos : seeds)
+    queue.push_back(size_t(pos.y) * dd.width + size_t(pos.x));
+  while (!queue.empty())
+  {
+    const size_t idx = queue.front();
+    queue.pop_front();
+    const size_t x = idx % dd.width;
+    const size_t y = idx / dd.width;
+    auto visit = [&](size_t nx, size_t ny)
+    {
+      const size_t nidx = ny * dd.width + nx;
+      if (nx < dd.width && ny < dd.height && dd.tiles[nidx] == dungeon::floor && map[idx] + 1.f < map[nidx])
+      {
+        map[nidx] = map[idx] + 1.f;
+        queue.push_back(nidx);
+      }
+    };
+    visit(x - 1, y);
+    visit(x + 1, y);
+    visit(x, y - 1);
+    visit(x, y + 1);
+  }
+  return map;
+}
+
+static size_t count_mismatches(const std::vector<float> &golden, const std::vector<float> &map)
+{
+  size_t mismatches = 0;
+  for (size_t i = 0; i < golden.size(); ++i)
+    if (golden[i] != map[i])
+      ++mismatches;
+  return mismatches;
+}
+
+// packed storage has to read back within half a step of the float map, invalid tiles stay invalid
+static size_t count_quantisation_errors(const std::vector<float> &golden, const DijkstraMapData &packed)
+{
+  size_t mismatches = 0;
+  for (size_t i = 0; i < golden.size(); ++i)
+  {
+    const float v = packed.at(i);
+    if (golden[i] >= invalid_tile_value ? v < invalid_tile_value : std::abs(v - golden[i]) > packed.step * 0.5f)
+      ++mismatches;
+  }
+  return mismatches;
+}
+
+static bool report(const char *name, double ms, size_t mismatches)
+{
+  if (mismatches == 0)
+    printf("  %-24s %9.3f ms  ok\n", name, ms);
+  else
+    printf("  %-24s %9.3f ms  MISMATCH on %zu tiles\n", name, ms, mismatches);
+  return mismatches == 0;
+}
+
+// hand made dungeon with fields stored next to it, base 36 distances and # for invalid tiles.
+// References above are computed by the same run, these catch changes that break every generator alike.
+constexpr size_t stored_size = 10;
+static const char *const stored_tiles[stored_size] = {
+  "##########",
+  "#    #   #",
+  "# ## # # #",
+  "# #    # #",
+  "# # #### #",
+  "#   #    #",
+  "### # ## #",
+  "#     #  #",
+  "# ###   ##",
+  "##########"};
+// player at 1, 1
+static const char *const stored_approach[stored_size] = {
+  "##########",
+  "#0123#9ab#",
+  "#1##4#8#c#",
+  "#2#6567#d#",
+  "#3#7####e#",
+  "#456#cdef#",
+  "###7#b##g#",
+  "#a989a#ef#",
+  "#b###bcd##",
+  "##########"};
+// hives at 8, 1 and 3, 7
+static const char *const stored_hive[stored_size] = {
+  "##########",
+  "#8987#210#",
+  "#7##6#3#1#",
+  "#6#4554#2#",
+  "#5#3####3#",
+  "#432#4554#",
+  "###1#3##5#",
+  "#21012#66#",
+  "#3###345##",
+  "##########"};
+
+static size_t count_stored_mismatches(const std::vector<float> &map, const char *const *rows)
+{
+  const char *digits = "0123456789abcdefghijklmnopqrstuvwxyz";
+  size_t mismatches = 0;
+  for (size_t i = 0; i < map.size(); ++i)
+  {
+    const char expected = rows[i / stored_size][i % stored_size];
+    const bool matches = expected == '#' ? map[i] >= invalid_tile_value
+                                         : map[i] == float(strchr(digits, expected) - digits);
+    if (!matches)
+      ++mismatches;
+  }
+  return mismatches;
+}
+
+static bool check_stored_fields()
+{
+  DungeonData dd;
+  dd.width = stored_size;
+  dd.height = stored_size;
+  for (const char *row : stored_tiles)
+    dd.tiles.insert(dd.tiles.end(), row, row + stored_size);
+  printf("stored dungeon %zux%zu\n", stored_size, stored_size);
+
+  const std::vector<Position> players = {Position{1, 1}};
+  const std::vector<Position> hives = {Position{8, 1}, Position{3, 7}};
+  bool ok = true;
+  std::vector<float> map;
+  double ms = time_ms(1, [&]() { dmaps::gen_player_approach_map(dd, players, map); });
+  ok &= report("approach (scan)", ms, count_stored_mismatches(map, stored_approach));
+  ms = time_ms(1, [&]() { map = bfs_map(dd, players); });
+  ok &= report("approach (bfs)", ms, count_stored_mismatches(map, stored_approach));
+  ms = time_ms(1, [&]() { dmaps::gen_hive_pack_map(dd, hives, map); });
+  ok &= report("hive (scan)", ms, count_stored_mismatches(map, stored_hive));
+  ms = time_ms(1, [&]() { map = bfs_map(dd, hives); });
+  ok &= report("hive (bfs)", ms, count_stored_mismatches(map, stored_hive));
+  return ok;
+}
+
+static bool bench_dungeon(size_t width, size_t height, unsigned seed, int iterations)
+{
+  DungeonData dd;
+  dd.tiles.resize(width * height);
+  dd.width = width;
+  dd.height = height;
+  gen_drunk_dungeon(dd.tiles.data(), width, height, seed);
+  printf("dungeon %zux%zu, seed %u, %d iterations\n", width, height, seed, iterations);
+
+  std::default_random_engine rng(seed);
+  const std::vector<Position> players = pick_floor_tiles(dd, 1, rng);
+  const std::vector<Position> hives = pick_floor_tiles(dd, 2, rng);
+  const std::vector<Position> allyPositions = pick_floor_tiles(dd, 4, rng);
+  std::vector<std::pair<Position, uint64_t>> allies;
+  for (size_t i = 0; i < allyPositions.size(); ++i)
+    allies.push_back({allyPositions[i], i + 1});
+
+  ExplorationData exploration;
+  exploration.explored.resize(width * height);
+  exploration.inFrontier.resize(width * height);
+  exploration.width = width;
+  exploration.height = height;
+  for (const Position &pos : pick_floor_tiles(dd, 8, rng))
+    dungeon::explore_box(exploration, dd, pos, 4);
+
+  bool ok = true;
+  std::vector<float> map;
+
+  {
+    const std::vector<float> golden = bfs_map(dd, players);
+    const double ms = time_ms(iterations, [&]() { dmaps::gen_player_approach_map(dd, players, map); });
+    ok &= report("approach (scan)", ms, count_mismatches(golden, map));
+  }
+  {
+    const std::vector<float> golden = bfs_map(dd, hives);
+    const double ms = time_ms(iterations, [&]() { dmaps::gen_hive_pack_map(dd, hives, map); });
+    ok &= report("hive (scan)", ms, count_mismatches(golden, map));
+  }
+
+  // flee: single dijkstra pass against negating the approach map and scanning it again
+  {
+    std::vector<float> approachMap;
+    dmaps::gen_player_approach_map(dd, players, approachMap);
+    std::vector<float> golden = approachMap;
+    for (float &v : golden)
+      if (v < invalid_tile_value)
+        v *= -1.2f;
+    dmaps::scan_dmap(dd, golden);
+    const double ms = time_ms(iterations, [&]() { dmaps::gen_player_flee_map(dd, approachMap, map); });
+    size_t mismatches = 0;
+    for (size_t i = 0; i < golden.size(); ++i)
+      if (std::abs(golden[i] - map[i]) > 1e-3f)
+        ++mismatches;
+    ok &= report("flee (dijkstra)", ms, mismatches);
+  }
+
+  // packed: maps are stored with the default quantisation step by the job system
+  {
+    std::vector<float> approachMap;
+    dmaps::gen_player_approach_map(dd, players, approachMap);
+    std::vector<float> fleeMap;
+    dmaps::gen_player_flee_map(dd, approachMap, fleeMap);
+    auto check_packed = [&](const char *name, const std::vector<float> &golden)
+    {
+      DijkstraMapData packed;
+      const double ms = time_ms(iterations, [&]()
+      {
+        packed.map = golden;
+        packed.quantise(dmaps::default_quantisation_step);
+      });
+      return report(name, ms, count_quantisation_errors(golden, packed));
+    };
+    ok &= check_packed("approach (packed)", approachMap);
+    ok &= check_packed("flee (packed)", fleeMap);
+    // past the 16 bit range the map has to come back exactly instead of saturated
+    std::vector<float> farMap = fleeMap;
+    for (float &v : farMap)
+      if (v < invalid_tile_value)
+        v -= 4000.f;
+    ok &= check_packed("far flee (packed)", farMap);
+  }
+
+  // exploration: frontier seeded BFS against seeding every unexplored tile, explorers only read explored tiles
+  {
+    std::vector<float> golden(width * height, invalid_tile_value);
+    for (size_t i = 0; i < golden.size(); ++i)
+      if (dd.tiles[i] != dungeon::wall && !exploration.explored.test(i))
+        golden[i] = 0.f;
+    dmaps::scan_dmap(dd, golden);
+    const double ms = time_ms(iterations, [&]() { dmaps::gen_exploration_map(dd, exploration, map); });
+    size_t mismatches = 0;
+    for (size_t i = 0; i < golden.size(); ++i)
+      if (exploration.explored.test(i) && dd.tiles[i] == dungeon::floor && golden[i] != map[i])
+        ++mismatches;
+    ok &= report("exploration (frontier)", ms, mismatches);
+  }
+
+  // ally labels: every source excluding itself has to see the scan over all other sources
+  {
+    DijkstraLabelMapData labelMap;
+    const double ms = time_ms(iterations, [&]() { dmaps::gen_ally_label_map(dd, allies, labelMap); });
+    size_t mismatches = 0;
+    for (const auto &[pos, source] : allies)
+    {
+      std::vector<Position> others;
+      for (const auto &[otherPos, otherSource] : allies)
+        if (otherSource != source)
+          others.push_back(otherPos);
+      std::vector<float> golden = seeded_map(dd, others);
+      dmaps::scan_dmap(dd, golden);
+      for (size_t i = 0; i < golden.size(); ++i)
+        if (dd.tiles[i] == dungeon::floor && golden[i] != labelMap.dist_excluding(i, source))
+          ++mismatches;
+    }
+    ok &= report("ally labels (bfs)", ms, mismatches);
+  }
+
+  // mage: every window has to match a scan from the same seeds with the rest of the dungeon walled off,
+  // tiles outside of all windows stay invalid
+  {
+    const int radius = 12;
+    const int size = 2 * radius + 1;
+    const std::vector<Position> mages = pick_floor_tiles(dd, 3, rng);
+    std::vector<float> golden(width * height, invalid_tile_value);
+    for (const Position &pos : mages)
+    {
+      DungeonData local;
+      local.width = size_t(size);
+      local.height = size_t(size);
+      local.tiles.assign(size_t(size * size), dungeon::wall);
+      std::vector<float> localMap(size_t(size * size), invalid_tile_value);
+      auto local_idx = [&](int x, int y) { return size_t((y - pos.y + radius) * size + (x - pos.x + radius)); };
+      auto in_map = [&](int x, int y) { return x >= 0 && y >= 0 && size_t(x) < width && size_t(y) < height; };
+      for (int y = pos.y - radius; y <= pos.y + radius; ++y)
+        for (int x = pos.x - radius; x <= pos.x + radius; ++x)
+          if (in_map(x, y))
+            local.tiles[local_idx(x, y)] = dd.tiles[size_t(y) * width + size_t(x)];
+      for (const Position &seed : dmaps::gen_mage_approach_seeds(dd, pos))
+        localMap[local_idx(seed.x, seed.y)] = 0.f;
+      dmaps::scan_dmap(local, localMap);
+      for (int y = pos.y - radius; y <= pos.y + radius; ++y)
+        for (int x = pos.x - radius; x <= pos.x + radius; ++x)
+          if (in_map(x, y))
+          {
+            float &v = golden[size_t(y) * width + size_t(x)];
+            v = std::min(v, localMap[local_idx(x, y)]);
+          }
+    }
+    DijkstraMapData windowed;
+    const double ms = time_ms(iterations, [&]() { dmaps::gen_mage_approach_map(dd, mages, radius, windowed); });
+    size_t mismatches = 0;
+    for (size_t i = 0; i < width * height; ++i)
+      if (windowed.at(i) != golden[i])
+        ++mismatches;
+    ok &= report("mage approach (window)", ms, mismatches);
+  }
+  return ok;
+}
+
+int run_dmap_bench(unsigned seed, int iterations)
+{
+  bool ok = check_stored_fields();
+  ok &= bench_dungeon(50, 50, seed, iterations);
+  ok &= bench_dungeon(200, 200, seed, iterations);
+  printf(ok ? "all maps match\n" : "some maps don't match\n");
+  return ok ? 0 : 1;
+}
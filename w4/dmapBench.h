@@ -0,0 +1,7 @@
+#pragma once
+
+// Headless benchmark of dijkstra map generators, runs without a window.
+// Faster generators are checked against the plain scan, the scan against a plain BFS and packed
+// storage against float maps on the same seeded dungeons, scan and BFS also against fields stored
+// for a small hand made dungeon. Returns non zero if any of them disagrees.
+int run_dmap_bench(unsigned seed, int iterations);
@@ -1,35 +1,221 @@
 #include "ecsTypes.h"
 #include "dmapFollower.h"
+#include "dmapRegistry.h"
 #include <cmath>
+#include <algorithm>
+
+// Sum of all weighted maps of one DmapWeights configuration, shared by every follower using it
+struct BlendedField
+{
+  struct LabelWeight
+  {
+    flecs::entity map;
+    DmapWeights::WtData wt;
+  };
+  DmapWeights weights;
+  std::vector<uint32_t> versions; // versions of the input maps the field was built from
+  std::vector<float> field;
+  std::vector<uint8_t> flow; // best move per tile, see build_flow_field
+  std::vector<LabelWeight> labelMaps; // can't be blended as each follower excludes itself
+  bool used = false;
+};
+
+static float weight_value(float v, float mult, float pow)
+{
+  if (v < 1e5f)
+    return powf(v * mult, pow);
+  return v;
+}
+
+// plain loop over decoded values, the pow == 1 case is kept separate to skip powf
+template<typename T, typename Decode>
+static void accumulate_values(std::vector<float> &field, const T *values, float mult, float pow, Decode decode)
+{
+  const size_t n = field.size();
+  float *out = field.data();
+  if (pow == 1.f)
+  {
+    for (size_t i = 0; i < n; ++i)
+    {
+      const float v = decode(values[i]);
+      out[i] += v < 1e5f ? v * mult : v;
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < n; ++i)
+      out[i] += weight_value(decode(values[i]), mult, pow);
+  }
+}
+
+// storage mode is checked once per map instead of in at() for every tile
+static void accumulate_weighted(std::vector<float> &field, const DijkstraMapData &dmap, float mult, float pow)
+{
+  if (dmap.windowed)
+  {
+    // windows are decoded into a full map first, overlapping windows keep the closest source
+    static std::vector<float> decoded;
+    decoded.assign(field.size(), 1e5f);
+    for (const DijkstraMapData::Window &window : dmap.windows)
+      for (int ly = 0; ly < window.size; ++ly)
+      {
+        const int y = window.y + ly;
+        if (y < 0 || size_t(y) >= dmap.height)
+          continue;
+        for (int lx = 0; lx < window.size; ++lx)
+        {
+          const int x = window.x + lx;
+          if (x < 0 || size_t(x) >= dmap.width)
+            continue;
+          float &v = decoded[size_t(y) * dmap.width + size_t(x)];
+          v = std::min(v, window.values[size_t(ly * window.size + lx)]);
+        }
+      }
+    accumulate_values(field, decoded.data(), mult, pow, [](float v) { return v; });
+  }
+  else if (dmap.step > 0.f)
+  {
+    const float step = dmap.step;
+    accumulate_values(field, dmap.packed.data(), mult, pow, [step](int16_t v)
+    {
+      return v == DijkstraMapData::packed_invalid ? 1e5f : float(v) * step;
+    });
+  }
+  else
+    accumulate_values(field, dmap.map.data(), mult, pow, [](float v) { return v; });
+}
+
+static std::vector<uint32_t> gather_versions(flecs::world &ecs, const BlendedField &blend)
+{
+  std::vector<uint32_t> res;
+  for (size_t i = 0; i < blend.weights.count; ++i)
+    dmaps::get_map_entity(ecs, blend.weights.weights[i].map).get([&](const DijkstraMapData &dmap)
+    {
+      res.push_back(dmap.version);
+    });
+  return res;
+}
+
+// Reduces the blended field to the best move of every tile, followers then need a single lookup.
+// Neighbours are compared in the same order and strictly, as followers sampling the field did.
+static void build_flow_field(const DungeonData &dd, BlendedField &blend)
+{
+  blend.flow.assign(dd.width * dd.height, uint8_t(EA_NOP));
+  if (dd.width < 3 || dd.height < 3)
+    return;
+  for (size_t y = 1; y + 1 < dd.height; ++y)
+  {
+    const float *row = blend.field.data() + y * dd.width;
+    const float *rowUp = row - dd.width;
+    const float *rowDown = row + dd.width;
+    uint8_t *out = blend.flow.data() + y * dd.width;
+    // branchless selects so the loop vectorizes
+    for (size_t x = 1; x + 1 < dd.width; ++x)
+    {
+      float best = row[x];
+      uint8_t dir = EA_NOP;
+      dir = row[x - 1] < best ? uint8_t(EA_MOVE_LEFT) : dir;
+      best = row[x - 1] < best ? row[x - 1] : best;
+      dir = row[x + 1] < best ? uint8_t(EA_MOVE_RIGHT) : dir;
+      best = row[x + 1] < best ? row[x + 1] : best;
+      dir = rowDown[x] < best ? uint8_t(EA_MOVE_DOWN) : dir;
+      best = rowDown[x] < best ? rowDown[x] : best;
+      dir = rowUp[x] < best ? uint8_t(EA_MOVE_UP) : dir;
+      out[x] = dir;
+    }
+  }
+}
+
+static void rebuild_field(flecs::world &ecs, const DungeonData &dd, BlendedField &blend)
+{
+  blend.field.assign(dd.width * dd.height, 0.f);
+  blend.labelMaps.clear();
+  for (size_t i = 0; i < blend.weights.count; ++i)
+  {
+    const DmapWeights::WtData &wt = blend.weights.weights[i];
+    flecs::entity mapEntity = dmaps::get_map_entity(ecs, wt.map);
+    mapEntity.get([&](const DijkstraMapData &dmap)
+    {
+      accumulate_weighted(blend.field, dmap, wt.mult, wt.pow);
+    });
+    if (mapEntity.has<DijkstraLabelMapData>())
+      blend.labelMaps.push_back({mapEntity, wt});
+  }
+  // label maps differ per follower, such fields are still sampled by every follower
+  if (blend.labelMaps.empty())
+    build_flow_field(dd, blend);
+  else
+    blend.flow.clear();
+}
 
 void process_dmap_followers(flecs::world &ecs)
 {
   static auto processDmapFollowers = ecs.query<const Position, Action, const DmapWeights>();
   static auto dungeonDataQuery = ecs.query<const DungeonData>();
+  static std::vector<BlendedField> blendCache;
 
-  auto get_dmap_at = [&](const DijkstraMapData &dmap, const DungeonData &dd, size_t x, size_t y, float mult, float pow)
+  // label maps are shared by the team, so the follower ignores its own label
+  auto get_label_dmap_at = [&](const DijkstraLabelMapData &dmap, flecs::entity self, const DungeonData &dd,
+                               size_t x, size_t y, float mult, float pow)
+  {
+    return weight_value(dmap.dist_excluding(y * dd.width + x, self.id()), mult, pow);
+  };
+  auto get_blended_field = [&](const DungeonData &dd, const DmapWeights &wt) -> BlendedField&
   {
-    const float v = dmap.map[y * dd.width + x];
-    if (v < 1e5f)
-      return powf(v * mult, pow);
-    return v;
+    for (BlendedField &blend : blendCache)
+      if (blend.weights == wt)
+      {
+        if (!blend.used)
+        {
+          // inputs are checked once per call, not per follower
+          std::vector<uint32_t> versions = gather_versions(ecs, blend);
+          if (versions != blend.versions)
+          {
+            blend.versions = std::move(versions);
+            rebuild_field(ecs, dd, blend);
+          }
+          blend.used = true;
+        }
+        return blend;
+      }
+    BlendedField &blend = blendCache.emplace_back();
+    blend.weights = wt;
+    blend.versions = gather_versions(ecs, blend);
+    rebuild_field(ecs, dd, blend);
+    blend.used = true;
+    return blend;
   };
   dungeonDataQuery.each([&](const DungeonData &dd)
   {
-    processDmapFollowers.each([&](const Position &pos, Action &act, const DmapWeights &wt)
+    processDmapFollowers.each([&](flecs::entity e, const Position &pos, Action &act, const DmapWeights &wt)
     {
+      const BlendedField &blend = get_blended_field(dd, wt);
+      if (!blend.flow.empty())
+      {
+        const uint8_t dir = blend.flow[pos.y * dd.width + pos.x];
+        if (dir != EA_NOP)
+          act.action = dir;
+        return;
+      }
+      auto get_field_at = [&](size_t x, size_t y)
+      {
+        return blend.field[y * dd.width + x];
+      };
       float moveWeights[EA_MOVE_END];
-      for (size_t i = 0; i < EA_MOVE_END; ++i)
-        moveWeights[i] = 0.f;
-      for (const auto &pair : wt.weights)
+      moveWeights[EA_NOP]         = get_field_at(pos.x+0, pos.y+0);
+      moveWeights[EA_MOVE_LEFT]   = get_field_at(pos.x-1, pos.y+0);
+      moveWeights[EA_MOVE_RIGHT]  = get_field_at(pos.x+1, pos.y+0);
+      moveWeights[EA_MOVE_UP]     = get_field_at(pos.x+0, pos.y-1);
+      moveWeights[EA_MOVE_DOWN]   = get_field_at(pos.x+0, pos.y+1);
+      for (const BlendedField::LabelWeight &label : blend.labelMaps)
       {
-        ecs.entity(pair.first.c_str()).get([&](const DijkstraMapData &dmap)
+        label.map.get([&](const DijkstraLabelMapData &dmap)
         {
-          moveWeights[EA_NOP]         += get_dmap_at(dmap, dd, pos.x+0, pos.y+0, pair.second.mult, pair.second.pow);
-          moveWeights[EA_MOVE_LEFT]   += get_dmap_at(dmap, dd, pos.x-1, pos.y+0, pair.second.mult, pair.second.pow);
-          moveWeights[EA_MOVE_RIGHT]  += get_dmap_at(dmap, dd, pos.x+1, pos.y+0, pair.second.mult, pair.second.pow);
-          moveWeights[EA_MOVE_UP]     += get_dmap_at(dmap, dd, pos.x+0, pos.y-1, pair.second.mult, pair.second.pow);
-          moveWeights[EA_MOVE_DOWN]   += get_dmap_at(dmap, dd, pos.x+0, pos.y+1, pair.second.mult, pair.second.pow);
+          moveWeights[EA_NOP]         += get_label_dmap_at(dmap, e, dd, pos.x+0, pos.y+0, label.wt.mult, label.wt.pow);
+          moveWeights[EA_MOVE_LEFT]   += get_label_dmap_at(dmap, e, dd, pos.x-1, pos.y+0, label.wt.mult, label.wt.pow);
+          moveWeights[EA_MOVE_RIGHT]  += get_label_dmap_at(dmap, e, dd, pos.x+1, pos.y+0, label.wt.mult, label.wt.pow);
+          moveWeights[EA_MOVE_UP]     += get_label_dmap_at(dmap, e, dd, pos.x+0, pos.y-1, label.wt.mult, label.wt.pow);
+          moveWeights[EA_MOVE_DOWN]   += get_label_dmap_at(dmap, e, dd, pos.x+0, pos.y+1, label.wt.mult, label.wt.pow);
         });
       }
       float minWt = moveWeights[EA_NOP];
@@ -41,5 +227,9 @@ void process_dmap_followers(flecs::world &ecs)
         }
     });
   });
-}
 
+  // drop configurations nobody uses anymore
+  std::erase_if(blendCache, [](const BlendedField &blend) { return !blend.used; });
+  for (BlendedField &blend : blendCache)
+    blend.used = false;
+}
@@ -2,3 +2,5 @@
 #include <cstddef> // size_t
 
 void gen_drunk_dungeon(char *tiles, size_t w, size_t h);
+// same dungeon for the same seed, for benchmarks
+void gen_drunk_dungeon(char *tiles, size_t w, size_t h, unsigned seed);
@@ -35,3 +35,35 @@ bool dungeon::is_tile_walkable(flecs::world &ecs, Position pos)
   return res;
 }
 
+
+// only the box is visited, so the cost scales with the revealed area and not the whole map
+void dungeon::explore_box(ExplorationData &data, const DungeonData &dd, Position pos, int radius)
+{
+  auto add_to_frontier = [&](size_t x, size_t y)
+  {
+    const size_t i = y * data.width + x;
+    if (x < data.width && y < data.height && dd.tiles[i] != dungeon::wall
+        && !data.explored.test(i) && !data.inFrontier.test(i))
+    {
+      data.inFrontier.set(i);
+      data.frontier.push_back(i);
+    }
+  };
+  bool revealed = false;
+  for (int y = std::max(pos.y - radius, 0); y <= std::min(pos.y + radius, int(data.height) - 1); ++y)
+    for (int x = std::max(pos.x - radius, 0); x <= std::min(pos.x + radius, int(data.width) - 1); ++x)
+    {
+      const size_t i = size_t(y) * data.width + size_t(x);
+      if (data.explored.test(i))
+        continue;
+      data.explored.set(i);
+      data.inFrontier.reset(i);
+      revealed = true;
+      add_to_frontier(size_t(x) - 1, size_t(y));
+      add_to_frontier(size_t(x) + 1, size_t(y));
+      add_to_frontier(size_t(x), size_t(y) - 1);
+      add_to_frontier(size_t(x), size_t(y) + 1);
+    }
+  if (revealed)
+    std::erase_if(data.frontier, [&](size_t i) { return data.explored.test(i); });
+}
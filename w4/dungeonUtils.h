@@ -9,4 +9,6 @@ namespace dungeon
 
   Position find_walkable_tile(flecs::world &ecs);
   bool is_tile_walkable(flecs::world &ecs, Position pos);
+  // marks a box around pos as explored and patches the frontier for newly revealed tiles
+  void explore_box(ExplorationData &data, const DungeonData &dd, Position pos, int radius);
 };
@@ -2,7 +2,13 @@
 
 #include <string>
 #include <vector>
-#include <unordered_map>
+#include <memory>
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 
 // TODO: make a lot of seprate files
 struct Position;
@@ -147,28 +153,168 @@ struct DungeonData
   size_t height;
 };
 
+// tiles don't change after generation, so map jobs share one copy made along with the dungeon
+struct DungeonSnapshot
+{
+  std::shared_ptr<const DungeonData> data;
+};
+
 struct DijkstraMapData
 {
   std::vector<float> map;
+  // optional 16 bit fixed point storage, used instead of map when step is set
+  std::vector<int16_t> packed;
+  float step = 0.f;
+  // optional windowed storage for short range maps, only squares around the sources are kept
+  struct Window
+  {
+    int x = 0; // top left corner in map tiles
+    int y = 0;
+    int size = 0;
+    std::vector<float> values; // size * size, row major
+  };
+  std::vector<Window> windows;
+  bool windowed = false;
+  size_t width = 0; // windowed maps have no full storage to take dimensions from
+  size_t height = 0;
+  uint32_t version = 0; // bumped every time the map is regenerated
+
+  static constexpr int16_t packed_invalid = INT16_MAX; // saturated sentinel for invalid tiles
+
+  size_t size() const
+  {
+    if (windowed)
+      return width * height;
+    return step > 0.f ? packed.size() : map.size();
+  }
+
+  // tiles outside of all windows are invalid, overlapping windows give the closest source
+  float window_at(int x, int y) const
+  {
+    float res = 1e5f;
+    for (const Window &window : windows)
+    {
+      const int lx = x - window.x;
+      const int ly = y - window.y;
+      if (lx >= 0 && ly >= 0 && lx < window.size && ly < window.size)
+        res = std::min(res, window.values[size_t(ly * window.size + lx)]);
+    }
+    return res;
+  }
+
+  float at(size_t idx) const
+  {
+    if (windowed)
+      return window_at(int(idx % width), int(idx / width));
+    if (step == 0.f)
+      return map[idx];
+    const int16_t v = packed[idx];
+    return v == packed_invalid ? 1e5f : float(v) * step;
+  }
+
+  // maps with values out of the 16 bit range stay in full precision instead of saturating
+  void quantise(float quant_step)
+  {
+    const float minValue = float(INT16_MIN) * quant_step;
+    const float maxValue = float(packed_invalid - 1) * quant_step;
+    for (float v : map)
+      if (v < 1e5f && (v < minValue || v > maxValue))
+      {
+        step = 0.f;
+        packed.clear();
+        return;
+      }
+    step = quant_step;
+    packed.resize(map.size());
+    for (size_t i = 0; i < map.size(); ++i)
+    {
+      if (map[i] >= 1e5f)
+        packed[i] = packed_invalid;
+      else
+        packed[i] = int16_t(std::clamp(std::lround(map[i] / step), long(INT16_MIN), long(packed_invalid - 1)));
+    }
+    map.clear();
+    map.shrink_to_fit();
+  }
+};
+
+// Two nearest sources for every tile, so each source can read distance to the closest other source
+struct DijkstraLabelMapData
+{
+  struct Label
+  {
+    float dist = 1e5f;
+    uint64_t source = 0; // entity id, 0 - no source
+  };
+  std::vector<Label> best;
+  std::vector<Label> second;
+
+  float dist_excluding(size_t idx, uint64_t self) const
+  {
+    return best[idx].source != self ? best[idx].dist : second[idx].dist;
+  }
+};
+
+// One bit per tile
+struct TileBitset
+{
+  std::vector<uint64_t> words;
+
+  void resize(size_t num_tiles) { words.assign((num_tiles + 63) / 64, 0); }
+  bool test(size_t idx) const { return (words[idx / 64] >> (idx % 64)) & 1u; }
+  void set(size_t idx) { words[idx / 64] |= uint64_t(1) << (idx % 64); }
+  void reset(size_t idx) { words[idx / 64] &= ~(uint64_t(1) << (idx % 64)); }
 };
 
 struct ExplorationData
 {
-  std::vector<bool> data;
+  TileBitset explored;
+  // unexplored non wall tiles next to explored ones, updated as tiles get revealed
+  std::vector<size_t> frontier;
+  TileBitset inFrontier;
   size_t width;
   size_t height;
 };
 
 struct VisualiseMap {};
 
+using DmapHandle = uint32_t; // interned map name, see dmapRegistry.h
+
 struct DmapWeights
 {
   struct WtData
   {
+    DmapHandle map = 0;
     float mult = 1.f;
     float pow = 1.f;
+
+    bool operator==(const WtData &) const = default;
   };
-  std::unordered_map<std::string, WtData> weights;
+  static constexpr size_t max_weights = 4;
+  std::array<WtData, max_weights> weights;
+  size_t count = 0;
+
+  void set(DmapHandle map, float mult, float pow)
+  {
+    for (size_t i = 0; i < count; ++i)
+      if (weights[i].map == map)
+      {
+        weights[i] = {map, mult, pow};
+        return;
+      }
+    if (count == max_weights)
+    {
+      // dropping a map would silently change how the follower moves
+      fprintf(stderr, "DmapWeights: more than %zu maps\n", max_weights);
+      abort();
+    }
+    weights[count++] = {map, mult, pow};
+  }
+
+  bool operator==(const DmapWeights &rhs) const
+  {
+    return count == rhs.count && std::equal(weights.data(), weights.data() + count, rhs.weights.data());
+  }
 };
 
 struct Hive {};
@@ -5,6 +5,9 @@
 #include "ecsTypes.h"
 #include "roguelike.h"
 #include "dungeonGen.h"
+#include "dmapBench.h"
+#include <cstring>
+#include <cstdlib>
 
 static void update_camera(Camera2D &cam, flecs::world &ecs)
 {
@@ -17,8 +20,12 @@ static void update_camera(Camera2D &cam, flecs::world &ecs)
   });
 }
 
-int main(int /*argc*/, const char ** /*argv*/)
+int main(int argc, const char **argv)
 {
+  // hw4 --bench-dmaps [seed] [iterations], runs before any window is created
+  if (argc > 1 && strcmp(argv[1], "--bench-dmaps") == 0)
+    return run_dmap_bench(argc > 2 ? unsigned(atoi(argv[2])) : 1u, argc > 3 ? std::max(atoi(argv[3]), 1) : 20);
+
   int width = 1920;
   int height = 1080;
   InitWindow(width, height, "w3 AI MIPT");
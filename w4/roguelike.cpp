@@ -8,39 +8,48 @@
 #include "dungeonUtils.h"
 #include "dijkstraMapGen.h"
 #include "dmapFollower.h"
+#include "dmapJobs.h"
+#include "dmapRegistry.h"
 #include "aiUtils.h"
 
 #include <sstream>
+#include <memory>
+#include <algorithm>
 
 static flecs::entity create_player_approacher(flecs::entity e)
 {
-  e.set(DmapWeights{{{"approach_map", {1.f, 1.f}}}});
+  e.set(dmaps::make_weights({{"approach_map", 1.f, 1.f}}));
   return e;
 }
 
 static flecs::entity create_player_fleer(flecs::entity e)
 {
-  e.set(DmapWeights{{{"flee_map", {1.f, 1.f}}}});
+  e.set(dmaps::make_weights({{"flee_map", 1.f, 1.f}}));
   return e;
 }
 
 static flecs::entity create_hive_follower(flecs::entity e)
 {
-  e.set(DmapWeights{{{"hive_map", {1.f, 1.f}}}});
+  e.set(dmaps::make_weights({{"hive_map", 1.f, 1.f}}));
   return e;
 }
 
 static flecs::entity create_hive_monster(flecs::entity e)
 {
-  e.set(DmapWeights{{{"hive_map", {1.f, 1.f}}, {"approach_map", {1.8, 0.8f}}}});
+  e.set(dmaps::make_weights({{"hive_map", 1.f, 1.f}, {"approach_map", 1.8f, 0.8f}}));
   return e;
 }
 
-static flecs::entity create_mage_monster(flecs::entity e)
+static std::string ally_map_name(int team)
 {
   std::stringstream allyMapName;
-  allyMapName << "ally_map_" << e.id();
-  e.set(DmapWeights{{{allyMapName.str().c_str(), {0.f, 1.f}}, {"mage_approach_map", {1.f, 1.f}}}});
+  allyMapName << "ally_map_" << team;
+  return allyMapName.str();
+}
+
+static flecs::entity create_mage_monster(flecs::entity e)
+{
+  e.set(dmaps::make_weights({{ally_map_name(e.get<Team>()->team).c_str(), 0.f, 1.f}, {"mage_approach_map", 1.f, 1.f}}));
   e.add<Mage>();
   return e;
 }
@@ -197,7 +206,7 @@ static void choose_exploration_action(flecs::world &ecs, Action &act, const Posi
 {
   auto get_dmap_at = [&](const DijkstraMapData &dmap, const DungeonData &dd, size_t x, size_t y)
   {
-    const float v = dmap.map[y * dd.width + x];
+    const float v = dmap.at(y * dd.width + x);
     if (v < 1e5f)
       return v;
     return v;
@@ -310,21 +319,27 @@ static void register_roguelike_systems(flecs::world &ecs)
     {
       dungeonDataQuery.each([&](const DungeonData &dd)
       {
-        for (size_t y = 0; y < dd.height; ++y)
-          for (size_t x = 0; x < dd.width; ++x)
+        // resolve every map once, the per tile loop only sums values
+        std::vector<float> sums(dd.width * dd.height, 0.f);
+        for (size_t i = 0; i < wt.count; ++i)
+        {
+          const DmapWeights::WtData &mapWt = wt.weights[i];
+          dmaps::get_map_entity(ecs, mapWt.map).get([&](const DijkstraMapData &dmap)
           {
-            float sum = 0.f;
-            for (const auto &pair : wt.weights)
+            for (size_t j = 0; j < sums.size(); ++j)
             {
-              ecs.entity(pair.first.c_str()).get([&](const DijkstraMapData &dmap)
-              {
-                float v = dmap.map[y * dd.width + x];
-                if (v < 1e5f)
-                  sum += powf(v * pair.second.mult, pair.second.pow);
-                else
-                  sum += v;
-              });
+              const float v = dmap.at(j);
+              if (v < 1e5f)
+                sums[j] += powf(v * mapWt.mult, mapWt.pow);
+              else
+                sums[j] += v;
             }
+          });
+        }
+        for (size_t y = 0; y < dd.height; ++y)
+          for (size_t x = 0; x < dd.width; ++x)
+          {
+            const float sum = sums[y * dd.width + x];
             if (sum < 1e5f)
               DrawText(TextFormat("%.1f", sum),
                   (float(x) + 0.2f) * tile_size, (float(y) + 0.5f) * tile_size, 150, WHITE);
@@ -340,7 +355,7 @@ static void register_roguelike_systems(flecs::world &ecs)
         for (size_t y = 0; y < dd.height; ++y)
           for (size_t x = 0; x < dd.width; ++x)
           {
-            const float val = dmap.map[y * dd.width + x];
+            const float val = dmap.at(y * dd.width + x);
             if (val < 1e5f)
               DrawText(TextFormat("%.1f", val),
                   (float(x) + 0.2f) * tile_size, (float(y) + 0.5f) * tile_size, 150, WHITE);
@@ -352,7 +367,7 @@ static void register_roguelike_systems(flecs::world &ecs)
       for (int y = 0; y < data.height; ++y)
         for (int x = 0; x < data.width; ++x)
         {
-          if (!data.data[y * data.width + x])
+          if (!data.explored.test(y * data.width + x))
           {
             const Rectangle rect = {float(x) * tile_size, float(y) * tile_size, tile_size, tile_size};
             DrawRectangleRec(rect, Color{0, 0, 0, 255});
@@ -361,6 +376,65 @@ static void register_roguelike_systems(flecs::world &ecs)
     });
 }
 
+static std::shared_ptr<const DungeonData> get_dungeon_data(flecs::world &ecs)
+{
+  static auto dungeonSnapshotQuery = ecs.query<const DungeonSnapshot>();
+  std::shared_ptr<const DungeonData> res;
+  dungeonSnapshotQuery.each([&](const DungeonSnapshot &snapshot)
+  {
+    res = snapshot.data;
+  });
+  return res;
+}
+
+// gathers sources for all maps on the main thread and hands generation over to the job system
+static void schedule_dmaps(flecs::world &ecs)
+{
+  static auto characterPositionQuery = ecs.query<const Position, const Team>();
+  static auto hiveQuery = ecs.query<const Position, const Hive>();
+  static auto explorationQuery = ecs.query<const ExplorationData>();
+
+  std::shared_ptr<const DungeonData> dd = get_dungeon_data(ecs);
+  std::vector<Position> players;
+  characterPositionQuery.each([&](const Position &pos, const Team &t)
+  {
+    if (t.team == 0) // player team hardcode
+      players.push_back(pos);
+  });
+  std::vector<Position> hives;
+  hiveQuery.each([&](const Position &pos, const Hive &)
+  {
+    hives.push_back(pos);
+  });
+
+  dmaps::JobSystem &jobs = dmaps::get_job_system();
+  // flee map is built from the approach map of the same turn instead of generating it again
+  jobs.add_map("approach_map", [dd, players](std::vector<float> &map)
+  {
+    dmaps::gen_player_approach_map(*dd, players, map);
+  }, {{"flee_map", [dd](const std::vector<float> &approach_map, std::vector<float> &map)
+  {
+    dmaps::gen_player_flee_map(*dd, approach_map, map);
+  }}});
+  jobs.add_map("hive_map", [dd, hives](std::vector<float> &map)
+  {
+    dmaps::gen_hive_pack_map(*dd, hives, map);
+  });
+  explorationQuery.each([&](const ExplorationData &data)
+  {
+    jobs.add_map("exploration_map", [dd, data](std::vector<float> &map)
+    {
+      dmaps::gen_exploration_map(*dd, data, map);
+    });
+  });
+  // mages only react to players nearby, so their map is kept to a window around each player
+  const int mageWindowRadius = 12;
+  jobs.add_window_map("mage_approach_map", [dd, players](DijkstraMapData &map)
+  {
+    dmaps::gen_mage_approach_map(*dd, players, mageWindowRadius, map);
+  });
+}
+
 void init_roguelike(flecs::world &ecs)
 {
   register_roguelike_systems(ecs);
@@ -391,73 +465,54 @@ void init_roguelike(flecs::world &ecs)
     .set(TurnCounter{})
     .set(ActionLog{});
 
-  std::vector<float> approachMap;
-  dmaps::gen_player_approach_map(ecs, approachMap);
-  ecs.entity("approach_map")
-    .set(DijkstraMapData{approachMap});
-
-  std::vector<float> fleeMap;
-  dmaps::gen_player_flee_map(ecs, fleeMap);
-  ecs.entity("flee_map")
-    .set(DijkstraMapData{fleeMap});
-
-  std::vector<float> hiveMap;
-  dmaps::gen_hive_pack_map(ecs, hiveMap);
-  ecs.entity("hive_map")
-    .set(DijkstraMapData{hiveMap});
-
   update_exploration_data(ecs);
-  std::vector<float> explorationMap;
-  dmaps::gen_exploration_map(ecs, explorationMap);
-  ecs.entity("exploration_map")
-    .set(DijkstraMapData{explorationMap});
-
   update_mage_ally_maps(ecs);
-  std::vector<float> mageApproachMap;
-  dmaps::gen_mage_approach_map(ecs, mageApproachMap);
-  ecs.entity("mage_approach_map")
-    .set(DijkstraMapData{mageApproachMap});
-}
-
-void update_ally_map(flecs::world &ecs, flecs::entity e, const Team &t)
-{
-  std::vector<float> allyMap;
-  dmaps::gen_ally_map(ecs, allyMap, e, t);
-  std::stringstream allyMapName;
-  allyMapName << "ally_map_" << e.id();
-  ecs.entity(allyMapName.str().c_str())
-    .set(DijkstraMapData{allyMap});
+  schedule_dmaps(ecs);
+  dmaps::get_job_system().sync(ecs);
 }
 
+// one label map per team instead of a full map per mage
 void update_mage_ally_maps(flecs::world &ecs)
 {
   static auto mageQuery = ecs.query<const Mage, const Hitpoints, const Team, DmapWeights>();
-  mageQuery.each([&](flecs::entity e, const Mage &, const Hitpoints &hp, const Team &t, DmapWeights &dw) {
-    update_ally_map(ecs, e, t);
-    std::stringstream allyMapName;
-    allyMapName << "ally_map_" << e.id();
-    auto &allyWeights = dw.weights[allyMapName.str().c_str()];
+  static auto characterPositionQuery = ecs.query<const Position, const Team>();
+  std::vector<int> mageTeams;
+  mageQuery.each([&](const Mage &, const Hitpoints &hp, const Team &t, DmapWeights &dw) {
+    if (std::find(mageTeams.begin(), mageTeams.end(), t.team) == mageTeams.end())
+      mageTeams.push_back(t.team);
+    const DmapHandle allyMap = dmaps::get_map_handle(ally_map_name(t.team).c_str());
     if (hp.hitpoints < 60.f)
-      allyWeights = {1.5f, 1.1f};
+      dw.set(allyMap, 1.5f, 1.1f);
     else
-      allyWeights = {0.0f, 1.0f};
+      dw.set(allyMap, 0.0f, 1.0f);
   });
+
+  std::shared_ptr<const DungeonData> dd = get_dungeon_data(ecs);
+  for (int team : mageTeams)
+  {
+    std::vector<std::pair<Position, uint64_t>> allies;
+    characterPositionQuery.each([&](flecs::entity e, const Position &pos, const Team &t)
+    {
+      if (t.team == team)
+        allies.emplace_back(pos, e.id());
+    });
+    dmaps::get_job_system().add_label_map(ally_map_name(team).c_str(), [dd, allies](DijkstraLabelMapData &map)
+    {
+      dmaps::gen_ally_label_map(*dd, allies, map);
+    });
+  }
 }
 
 void update_exploration_data(flecs::world &ecs)
 {
   static auto playerPosQuery = ecs.query<const IsPlayer, const Position>();
   static auto explorationDataQuery = ecs.query<ExplorationData>();
-  playerPosQuery.each([&](const IsPlayer, const Position &playerPos) {
-    explorationDataQuery.each([&](ExplorationData &data) {
-      for (size_t y = 0; y < data.height; ++y)
-        for (size_t x = 0; x < data.width; ++x)
-        {
-          size_t i = y * data.width + x;
-          if (abs(playerPos.x - int(x)) <= 2
-              && abs(playerPos.y - int(y)) <= 2)
-            data.data[i] = data.data[i] | true;
-        }
+  static auto dungeonDataQuery = ecs.query<const DungeonData>();
+  dungeonDataQuery.each([&](const DungeonData &dd) {
+    playerPosQuery.each([&](const IsPlayer, const Position &playerPos) {
+      explorationDataQuery.each([&](ExplorationData &data) {
+        dungeon::explore_box(data, dd, playerPos, 2);
+      });
     });
   });
 }
@@ -474,13 +529,18 @@ void init_dungeon(flecs::world &ecs, char *tiles, size_t w, size_t h)
   for (size_t y = 0; y < h; ++y)
     for (size_t x = 0; x < w; ++x)
       dungeonData[y * w + x] = tiles[y * w + x];
+  DungeonData dd{dungeonData, w, h};
   ecs.entity("dungeon")
-    .set(DungeonData{dungeonData, w, h});
-
-  std::vector<bool> explorationData;
-  explorationData.resize(w * h);
+    .set(DungeonSnapshot{std::make_shared<const DungeonData>(dd)})
+    .set(std::move(dd));
+
+  ExplorationData explorationData;
+  explorationData.explored.resize(w * h);
+  explorationData.inFrontier.resize(w * h);
+  explorationData.width = w;
+  explorationData.height = h;
   ecs.entity("explorationData")
-    .set(ExplorationData{explorationData, w, h});
+    .set(explorationData);
 
   for (size_t y = 0; y < h; ++y)
     for (size_t x = 0; x < w; ++x)
@@ -661,6 +721,8 @@ void process_turn(flecs::world &ecs)
   static auto turnIncrementer = ecs.query<TurnCounter>();
   if (is_player_acted(ecs))
   {
+    // maps scheduled on the previous turn have to be ready before followers read them
+    dmaps::get_job_system().sync(ecs);
     if (upd_player_actions_count(ecs))
     {
       // Plan action for NPCs
@@ -681,36 +743,13 @@ void process_turn(flecs::world &ecs)
     }
     process_actions(ecs);
 
-    std::vector<float> approachMap;
-    dmaps::gen_player_approach_map(ecs, approachMap);
-    ecs.entity("approach_map")
-      .set(DijkstraMapData{approachMap});
-
-    std::vector<float> fleeMap;
-    dmaps::gen_player_flee_map(ecs, fleeMap);
-    ecs.entity("flee_map")
-      .set(DijkstraMapData{fleeMap});
-
-    std::vector<float> hiveMap;
-    dmaps::gen_hive_pack_map(ecs, hiveMap);
-    ecs.entity("hive_map")
-      .set(DijkstraMapData{hiveMap});
-
     update_exploration_data(ecs);
-    std::vector<float> explorationMap;
-    dmaps::gen_exploration_map(ecs, explorationMap);
-    ecs.entity("exploration_map")
-      .set(DijkstraMapData{explorationMap});
-
     update_mage_ally_maps(ecs);
-    std::vector<float> mageApproachMap;
-    dmaps::gen_mage_approach_map(ecs, mageApproachMap);
-    ecs.entity("mage_approach_map")
-      .set(DijkstraMapData{mageApproachMap});
+    schedule_dmaps(ecs);
 
     // ecs.entity("mage_approach_map").add<VisualiseMap>();
     // ecs.entity("hive_follower_sum")
-    //   .set(DmapWeights{{{"hive_map", {1.f, 1.f}}, {"approach_map", {1.8f, 0.8f}}}})
+    //   .set(dmaps::make_weights({{"hive_map", 1.f, 1.f}, {"approach_map", 1.8f, 0.8f}}))
     //   .add<VisualiseMap>();
   }
 }
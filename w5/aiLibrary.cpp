@@ -77,19 +77,13 @@ class EnemyAvailableTransition : public StateTransition
   float triggerDist;
 public:
   EnemyAvailableTransition(float in_dist) : triggerDist(in_dist) {}
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
+  bool isAvailable(flecs::world &, flecs::entity entity) const override
   {
-    static auto enemiesQuery = ecs.query<const Position, const Team>();
     bool enemiesFound = false;
     entity.get([&](const Position &pos, const Team &t)
     {
-      enemiesQuery.each([&](const Position &epos, const Team &et)
-      {
-        if (t.team == et.team)
-          return;
-        float curDist = dist(epos, pos);
-        enemiesFound |= curDist <= triggerDist;
-      });
+      get_spatial_hash().within_radius(pos, triggerDist, t.team, TeamFilter::OtherTeams,
+                                       [&](const SpatialEntry &, int) { enemiesFound = true; });
     });
     return enemiesFound;
   }
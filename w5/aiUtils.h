@@ -3,6 +3,7 @@
 #include "blackboard.h"
 #include <float.h>
 #include "math.h"
+#include "spatialHash.h"
 
 template<typename T, typename U>
 inline int move_towards(const T &from, const U &to)
@@ -25,26 +26,12 @@ inline int inverse_move(int move)
 template<typename Callable>
 inline void on_closest_enemy_pos(flecs::world &ecs, flecs::entity entity, Callable c)
 {
-  static auto enemiesQuery = ecs.query<const Position, const Team>();
+  static std::vector<SpatialEntry> closest;
   entity.set([&](const Position &pos, const Team &t, Action &a)
   {
-    flecs::entity closestEnemy;
-    float closestDist = FLT_MAX;
-    Position closestPos;
-    enemiesQuery.each([&](flecs::entity enemy, const Position &epos, const Team &et)
-    {
-      if (t.team == et.team)
-        return;
-      float curDist = dist(epos, pos);
-      if (curDist < closestDist)
-      {
-        closestDist = curDist;
-        closestPos = epos;
-        closestEnemy = enemy;
-      }
-    });
-    if (ecs.is_valid(closestEnemy))
-      c(a, pos, closestPos);
+    get_spatial_hash().k_nearest(pos, t.team, TeamFilter::OtherTeams, 1, closest);
+    if (!closest.empty() && ecs.is_valid(closest[0].entity))
+      c(a, pos, closest[0].pos);
   });
 }
 
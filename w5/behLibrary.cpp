@@ -4,6 +4,7 @@
 #include "math.h"
 #include "raylib.h"
 #include "blackboard.h"
+#include "spatialHash.h"
 #include <algorithm>
 
 struct CompoundNode : public BehNode
@@ -140,27 +141,13 @@ struct FindEnemy : public BehNode
   BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
   {
     BehResult res = BEH_FAIL;
-    static auto enemiesQuery = ecs.query<const Position, const Team>();
+    static std::vector<SpatialEntry> closest;
     entity.set([&](const Position &pos, const Team &t)
     {
-      flecs::entity closestEnemy;
-      float closestDist = FLT_MAX;
-      Position closestPos;
-      enemiesQuery.each([&](flecs::entity enemy, const Position &epos, const Team &et)
+      get_spatial_hash().k_nearest(pos, t.team, TeamFilter::OtherTeams, 1, closest);
+      if (!closest.empty() && ecs.is_valid(closest[0].entity) && dist(closest[0].pos, pos) <= distance)
       {
-        if (t.team == et.team)
-          return;
-        float curDist = dist(epos, pos);
-        if (curDist < closestDist)
-        {
-          closestDist = curDist;
-          closestPos = epos;
-          closestEnemy = enemy;
-        }
-      });
-      if (ecs.is_valid(closestEnemy) && closestDist <= distance)
-      {
-        bb.set<flecs::entity>(entityBb, closestEnemy);
+        bb.set<flecs::entity>(entityBb, closest[0].entity);
         res = BEH_SUCCESS;
       }
     });
@@ -1,22 +1,7 @@
 #include "dijkstraMapGen.h"
 #include "ecsTypes.h"
 #include "dungeonUtils.h"
-
-template<typename Callable>
-static void query_dungeon_data(flecs::world &ecs, Callable c)
-{
-  static auto dungeonDataQuery = ecs.query<const DungeonData>();
-
-  dungeonDataQuery.each(c);
-}
-
-template<typename Callable>
-static void query_characters_positions(flecs::world &ecs, Callable c)
-{
-  static auto characterPositionQuery = ecs.query<const Position, const Team>();
-
-  characterPositionQuery.each(c);
-}
+#include <queue>
 
 constexpr float invalid_tile_value = 1e5f;
 
@@ -66,43 +51,61 @@ static void process_dmap(std::vector<float> &map, const DungeonData &dd)
   }
 }
 
-void dmaps::gen_player_approach_map(flecs::world &ecs, std::vector<float> &map)
+void dmaps::gen_player_approach_map(const DungeonData &dd, const std::vector<Position> &players, std::vector<float> &map)
 {
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
-  {
-    init_tiles(map, dd);
-    query_characters_positions(ecs, [&](const Position &pos, const Team &t)
-    {
-      if (t.team == 0) // player team hardcode
-        map[pos.y * dd.width + pos.x] = 0.f;
-    });
-    process_dmap(map, dd);
-  });
+  init_tiles(map, dd);
+  for (const Position &pos : players)
+    map[pos.y * dd.width + pos.x] = 0.f;
+  process_dmap(map, dd);
 }
 
-void dmaps::gen_player_flee_map(flecs::world &ecs, std::vector<float> &map)
+void dmaps::gen_player_flee_map(const DungeonData &dd, const std::vector<Position> &players, std::vector<float> &map)
 {
-  gen_player_approach_map(ecs, map);
-  for (float &v : map)
-    if (v < invalid_tile_value)
-      v *= -1.2f;
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
-  {
-    process_dmap(map, dd);
-  });
+  std::vector<float> approachMap;
+  gen_player_approach_map(dd, players, approachMap);
+  gen_player_flee_map(dd, approachMap, map);
 }
 
-void dmaps::gen_hive_pack_map(flecs::world &ecs, std::vector<float> &map)
+// scaled approach values are the seeds of a single Dijkstra pass, no second scan over the whole map
+void dmaps::gen_player_flee_map(const DungeonData &dd, const std::vector<float> &approach_map, std::vector<float> &map)
 {
-  static auto hiveQuery = ecs.query<const Position, const Hive>();
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
+  using QueueItem = std::pair<float, size_t>;
+  std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem>> queue;
+  init_tiles(map, dd);
+  for (size_t i = 0; i < approach_map.size(); ++i)
+    if (approach_map[i] < invalid_tile_value)
+    {
+      map[i] = approach_map[i] * -1.2f;
+      queue.push({map[i], i});
+    }
+  while (!queue.empty())
   {
-    init_tiles(map, dd);
-    hiveQuery.each([&](const Position &pos, const Hive &)
+    const auto [dist, idx] = queue.top();
+    queue.pop();
+    if (dist > map[idx])
+      continue; // stale entry, the tile was already reached cheaper
+    const size_t x = idx % dd.width;
+    const size_t y = idx / dd.width;
+    auto relax = [&](size_t nx, size_t ny)
     {
-      map[pos.y * dd.width + pos.x] = 0.f;
-    });
-    process_dmap(map, dd);
-  });
+      const size_t nidx = ny * dd.width + nx;
+      if (nx < dd.width && ny < dd.height && dd.tiles[nidx] == dungeon::floor && dist + 1.f < map[nidx])
+      {
+        map[nidx] = dist + 1.f;
+        queue.push({map[nidx], nidx});
+      }
+    };
+    relax(x - 1, y + 0);
+    relax(x + 1, y + 0);
+    relax(x + 0, y - 1);
+    relax(x + 0, y + 1);
+  }
 }
 
+void dmaps::gen_hive_pack_map(const DungeonData &dd, const std::vector<Position> &hives, std::vector<float> &map)
+{
+  init_tiles(map, dd);
+  for (const Position &pos : hives)
+    map[pos.y * dd.width + pos.x] = 0.f;
+  process_dmap(map, dd);
+}
@@ -1,11 +1,15 @@
 #pragma once
 #include <vector>
-#include <flecs.h>
+#include "ecsTypes.h"
 
+// Generators only read the dungeon and the source data gathered by the caller,
+// so they don't touch the ecs and can be run from worker threads.
 namespace dmaps
 {
-  void gen_player_approach_map(flecs::world &ecs, std::vector<float> &map);
-  void gen_player_flee_map(flecs::world &ecs, std::vector<float> &map);
-  void gen_hive_pack_map(flecs::world &ecs, std::vector<float> &map);
+  void gen_player_approach_map(const DungeonData &dd, const std::vector<Position> &players, std::vector<float> &map);
+  void gen_player_flee_map(const DungeonData &dd, const std::vector<Position> &players, std::vector<float> &map);
+  // same flee map built from an already generated approach map
+  void gen_player_flee_map(const DungeonData &dd, const std::vector<float> &approach_map, std::vector<float> &map);
+  void gen_hive_pack_map(const DungeonData &dd, const std::vector<Position> &hives, std::vector<float> &map);
 };
 
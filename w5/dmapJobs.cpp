@@ -0,0 +1,100 @@
+#include "dmapJobs.h"
+#include "dmapRegistry.h"
+#include <algorithm>
+
+dmaps::JobSystem::JobSystem(size_t num_workers)
+{
+  for (size_t i = 0; i < num_workers; ++i)
+    workers.emplace_back([this]() { worker_loop(); });
+}
+
+dmaps::JobSystem::~JobSystem()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  jobAdded.notify_all();
+  for (std::thread &worker : workers)
+    worker.join();
+}
+
+void dmaps::JobSystem::worker_loop()
+{
+  while (true)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    jobAdded.wait(lock, [&]() { return stopping || nextJob < jobs.size(); });
+    if (stopping)
+      return;
+    MapJob &job = jobs[nextJob++];
+    lock.unlock();
+
+    job.gen(job.dmap.map);
+    for (DerivedJob &derived : job.derived)
+    {
+      derived.gen(job.dmap.map, derived.dmap.map);
+      if (derived.quantStep > 0.f)
+        derived.dmap.quantise(derived.quantStep);
+    }
+    if (job.quantStep > 0.f)
+      job.dmap.quantise(job.quantStep);
+
+    lock.lock();
+    ++numDone;
+    lock.unlock();
+    jobDone.notify_all();
+  }
+}
+
+void dmaps::JobSystem::add_map(const char *name, MapGenerator gen, float quant_step)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(MapJob{get_map_handle(name), std::move(gen), quant_step, {}, {}});
+  }
+  jobAdded.notify_one();
+}
+
+void dmaps::JobSystem::add_map(const char *name, MapGenerator gen, std::vector<DerivedMap> derived, float quant_step)
+{
+  std::vector<DerivedJob> derivedJobs;
+  for (DerivedMap &map : derived)
+    derivedJobs.push_back(DerivedJob{get_map_handle(map.name), std::move(map.gen), map.quantStep, {}});
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    MapJob &job = jobs.emplace_back();
+    job.map = get_map_handle(name);
+    job.gen = std::move(gen);
+    job.quantStep = quant_step;
+    job.derived = std::move(derivedJobs);
+  }
+  jobAdded.notify_one();
+}
+
+void dmaps::JobSystem::sync(flecs::world &ecs)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  jobDone.wait(lock, [&]() { return numDone == jobs.size(); });
+  for (MapJob &job : jobs)
+  {
+    job.dmap.version = ++mapVersion;
+    get_map_entity(ecs, job.map)
+      .set(std::move(job.dmap));
+    for (DerivedJob &derived : job.derived)
+    {
+      derived.dmap.version = ++mapVersion;
+      get_map_entity(ecs, derived.map)
+        .set(std::move(derived.dmap));
+    }
+  }
+  jobs.clear();
+  nextJob = 0;
+  numDone = 0;
+}
+
+dmaps::JobSystem &dmaps::get_job_system()
+{
+  static JobSystem jobSystem(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+  return jobSystem;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <flecs.h>
+#include "ecsTypes.h"
+
+namespace dmaps
+{
+  using MapGenerator = std::function<void(std::vector<float> &)>;
+
+  // precision of packed maps, with 16 bits it keeps distances up to 2047 tiles, larger maps stay float
+  constexpr float default_quantisation_step = 1.f / 16.f;
+  // builds a map from the full precision values of another map scheduled in the same job
+  using DerivedMapGenerator = std::function<void(const std::vector<float> &, std::vector<float> &)>;
+
+  struct DerivedMap
+  {
+    const char *name;
+    DerivedMapGenerator gen;
+    float quantStep = default_quantisation_step;
+  };
+
+  // Builds independent dijkstra maps on a pool of worker threads.
+  // Generators must not touch the ecs, everything they need is captured when the job is added.
+  class JobSystem
+  {
+    struct DerivedJob
+    {
+      DmapHandle map;
+      DerivedMapGenerator gen;
+      float quantStep;
+      DijkstraMapData dmap;
+    };
+
+    struct MapJob
+    {
+      DmapHandle map;
+      MapGenerator gen;
+      float quantStep;
+      DijkstraMapData dmap;
+      std::vector<DerivedJob> derived;
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<MapJob> jobs; // deque so workers can hold references while new jobs are pushed
+    size_t nextJob = 0;
+    size_t numDone = 0;
+    uint32_t mapVersion = 0;
+    bool stopping = false;
+
+    std::mutex mutex;
+    std::condition_variable jobAdded;
+    std::condition_variable jobDone;
+
+    void worker_loop();
+  public:
+    explicit JobSystem(size_t num_workers);
+    ~JobSystem();
+
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+
+    // quant_step of 0 keeps the map in full float precision
+    void add_map(const char *name, MapGenerator gen, float quant_step = default_quantisation_step);
+    // derived maps are built on the same worker right after the source one, so they don't regenerate it
+    void add_map(const char *name, MapGenerator gen, std::vector<DerivedMap> derived,
+                 float quant_step = default_quantisation_step);
+    // barrier, waits for all added maps and sets them to their map entities
+    void sync(flecs::world &ecs);
+  };
+
+  JobSystem &get_job_system();
+};
+
@@ -0,0 +1,39 @@
+#include "dmapRegistry.h"
+#include <vector>
+#include <unordered_map>
+
+static std::unordered_map<std::string, DmapHandle> mapHandles;
+static std::vector<std::string> mapNames;
+static std::vector<flecs::entity> mapEntities;
+
+DmapHandle dmaps::get_map_handle(const char *name)
+{
+  auto itf = mapHandles.find(name);
+  if (itf != mapHandles.end())
+    return itf->second;
+  const DmapHandle res = DmapHandle(mapNames.size());
+  mapHandles.emplace(name, res);
+  mapNames.emplace_back(name);
+  mapEntities.emplace_back();
+  return res;
+}
+
+const std::string &dmaps::get_map_name(DmapHandle map)
+{
+  return mapNames[map];
+}
+
+flecs::entity dmaps::get_map_entity(flecs::world &ecs, DmapHandle map)
+{
+  if (!mapEntities[map])
+    mapEntities[map] = ecs.entity(mapNames[map].c_str());
+  return mapEntities[map];
+}
+
+DmapWeights dmaps::make_weights(std::initializer_list<NamedWeight> weights)
+{
+  DmapWeights res;
+  for (const NamedWeight &wt : weights)
+    res.set(get_map_handle(wt.name), wt.mult, wt.pow);
+  return res;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+#include <initializer_list>
+#include <flecs.h>
+#include "ecsTypes.h"
+
+// Interns dijkstra map names into dense handles, so hot loops never hash strings
+namespace dmaps
+{
+  DmapHandle get_map_handle(const char *name);
+  const std::string &get_map_name(DmapHandle map);
+  // map entities are resolved once and cached per handle
+  flecs::entity get_map_entity(flecs::world &ecs, DmapHandle map);
+
+  struct NamedWeight
+  {
+    const char *name;
+    float mult = 1.f;
+    float pow = 1.f;
+  };
+  // at most DmapWeights::max_weights distinct maps, more abort
+  DmapWeights make_weights(std::initializer_list<NamedWeight> weights);
+};
+
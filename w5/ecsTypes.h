@@ -2,7 +2,13 @@
 
 #include <string>
 #include <vector>
-#include <unordered_map>
+#include <memory>
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 
 // TODO: make a lot of seprate files
 struct Position;
@@ -145,21 +151,97 @@ struct DungeonData
   size_t height;
 };
 
+// tiles don't change after generation, so map jobs share one copy made along with the dungeon
+struct DungeonSnapshot
+{
+  std::shared_ptr<const DungeonData> data;
+};
+
 struct DijkstraMapData
 {
   std::vector<float> map;
+  // optional 16 bit fixed point storage, used instead of map when step is set
+  std::vector<int16_t> packed;
+  float step = 0.f;
+  uint32_t version = 0; // bumped every time the map is regenerated
+
+  static constexpr int16_t packed_invalid = INT16_MAX; // saturated sentinel for invalid tiles
+
+  size_t size() const { return step > 0.f ? packed.size() : map.size(); }
+
+  float at(size_t idx) const
+  {
+    if (step == 0.f)
+      return map[idx];
+    const int16_t v = packed[idx];
+    return v == packed_invalid ? 1e5f : float(v) * step;
+  }
+
+  // maps with values out of the 16 bit range stay in full precision instead of saturating
+  void quantise(float quant_step)
+  {
+    const float minValue = float(INT16_MIN) * quant_step;
+    const float maxValue = float(packed_invalid - 1) * quant_step;
+    for (float v : map)
+      if (v < 1e5f && (v < minValue || v > maxValue))
+      {
+        step = 0.f;
+        packed.clear();
+        return;
+      }
+    step = quant_step;
+    packed.resize(map.size());
+    for (size_t i = 0; i < map.size(); ++i)
+    {
+      if (map[i] >= 1e5f)
+        packed[i] = packed_invalid;
+      else
+        packed[i] = int16_t(std::clamp(std::lround(map[i] / step), long(INT16_MIN), long(packed_invalid - 1)));
+    }
+    map.clear();
+    map.shrink_to_fit();
+  }
 };
 
 struct VisualiseMap {};
 
+using DmapHandle = uint32_t; // interned map name, see dmapRegistry.h
+
 struct DmapWeights
 {
   struct WtData
   {
+    DmapHandle map = 0;
     float mult = 1.f;
     float pow = 1.f;
+
+    bool operator==(const WtData &) const = default;
   };
-  std::unordered_map<std::string, WtData> weights;
+  static constexpr size_t max_weights = 4;
+  std::array<WtData, max_weights> weights;
+  size_t count = 0;
+
+  void set(DmapHandle map, float mult, float pow)
+  {
+    for (size_t i = 0; i < count; ++i)
+      if (weights[i].map == map)
+      {
+        weights[i] = {map, mult, pow};
+        return;
+      }
+    if (count == max_weights)
+    {
+      // dropping a map would silently change how the follower moves
+      fprintf(stderr, "DmapWeights: more than %zu maps\n", max_weights);
+      abort();
+    }
+    weights[count++] = {map, mult, pow};
+  }
+
+  bool operator==(const DmapWeights &rhs) const
+  {
+    return count == rhs.count && std::equal(weights.data(), weights.data() + count, rhs.weights.data());
+  }
 };
 
 struct Hive {};
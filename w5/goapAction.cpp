@@ -9,7 +9,9 @@ goap::Action goap::create_action(const char *name, const WorldDesc &desc, float
   {
     res.precondition.push_back(-1);
     res.effect.push_back(-1);
-    res.setBitset.push_back(true);
+    res.precondMask.push_back(0);
+    res.setMask.push_back(0);
+    res.additiveEffect.push_back(0);
   }
   return res;
 }
@@ -20,6 +22,7 @@ void goap::set_action_precond(Action &act, const WorldDesc &desc, const char *st
   if (itf == desc.end())
     return; // TODO: Assert
   act.precondition[itf->second] = val;
+  act.precondMask[itf->second] = val < 0 ? 0 : -1;
 }
 
 void goap::set_action_effect(Action &act, const WorldDesc &desc, const char *st_name, int8_t val)
@@ -28,6 +31,8 @@ void goap::set_action_effect(Action &act, const WorldDesc &desc, const char *st_
   if (itf == desc.end())
     return; // TODO: Assert
   act.effect[itf->second] = val;
+  act.setMask[itf->second] = val < 0 ? 0 : -1;
+  act.additiveEffect[itf->second] = 0;
 }
 
 void goap::set_additive_action_effect(Action &act, const WorldDesc &desc, const char *st_name, int8_t val)
@@ -36,6 +41,7 @@ void goap::set_additive_action_effect(Action &act, const WorldDesc &desc, const
   if (itf == desc.end())
     return; // TODO: Assert
   act.effect[itf->second] = val;
-  act.setBitset[itf->second] = false;
+  act.setMask[itf->second] = 0;
+  act.additiveEffect[itf->second] = val;
 }
 
@@ -12,7 +12,10 @@ namespace goap
     WorldState precondition;
     WorldState effect;
 
-    std::vector<bool> setBitset; // if effect sets world state, or is it additive (true - sets, false - additive)
+    // packed form used by the search, 0xff in a slot mask means the slot is used
+    WorldState precondMask;
+    WorldState setMask; // effect sets the slot
+    WorldState additiveEffect; // added to the slot, 0 for the rest
 
     float cost = 1.f;
   };
@@ -22,4 +25,3 @@ namespace goap
   void set_action_effect(Action &act, const WorldDesc &desc, const char *st_name, int8_t val);
   void set_additive_action_effect(Action &act, const WorldDesc &desc, const char *st_name, int8_t val);
 };
-
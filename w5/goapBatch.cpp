@@ -0,0 +1,112 @@
+#include "goapPlanner.h"
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+  // Persistent workers of plan_batch, so their thread local search memory is reused between batches.
+  // Same worker/sync pattern as dmaps::JobSystem, requests of one batch are taken by index.
+  class PlanWorkers
+  {
+    std::vector<std::thread> workers;
+    std::function<void(size_t)> task;
+    size_t count = 0;
+    size_t nextRequest = 0;
+    size_t numDone = 0;
+    bool stopping = false;
+
+    std::mutex batchMutex; // one batch at a time
+    std::mutex mutex;
+    std::condition_variable requestAdded;
+    std::condition_variable requestDone;
+
+    void worker_loop()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true)
+      {
+        requestAdded.wait(lock, [&]() { return stopping || nextRequest < count; });
+        if (stopping)
+          return;
+        const size_t idx = nextRequest++;
+        lock.unlock();
+        task(idx);
+        lock.lock();
+        if (++numDone == count)
+          requestDone.notify_all();
+      }
+    }
+
+  public:
+    explicit PlanWorkers(size_t num_workers)
+    {
+      for (size_t i = 0; i < num_workers; ++i)
+        workers.emplace_back([this]() { worker_loop(); });
+    }
+
+    ~PlanWorkers()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      requestAdded.notify_all();
+      for (std::thread &worker : workers)
+        worker.join();
+    }
+
+    PlanWorkers(const PlanWorkers &) = delete;
+    PlanWorkers &operator=(const PlanWorkers &) = delete;
+
+    // calls in_task for every index below in_count, returns once all of them are done
+    void run(size_t in_count, std::function<void(size_t)> in_task)
+    {
+      std::lock_guard<std::mutex> batchLock(batchMutex);
+      std::unique_lock<std::mutex> lock(mutex);
+      task = std::move(in_task);
+      count = in_count;
+      nextRequest = 0;
+      numDone = 0;
+      lock.unlock();
+      requestAdded.notify_all();
+
+      // calling thread takes requests as well
+      lock.lock();
+      while (nextRequest < count)
+      {
+        const size_t idx = nextRequest++;
+        lock.unlock();
+        task(idx);
+        lock.lock();
+        ++numDone;
+      }
+      requestDone.wait(lock, [&]() { return numDone == count; });
+      count = 0;
+      task = nullptr;
+    }
+  };
+}
+
+static PlanWorkers &get_plan_workers()
+{
+  static PlanWorkers planWorkers(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+  return planWorkers;
+}
+
+std::vector<goap::PlanResult> goap::plan_batch(const Planner &planner, std::span<const WorldState> starts,
+                                               std::span<const WorldState> goals, PlanDirection direction)
+{
+  const size_t count = std::min(starts.size(), goals.size());
+  std::vector<PlanResult> results(count);
+  if (count == 0)
+    return results;
+  // every thread keeps its own search memory, requests only share the planner
+  get_plan_workers().run(count, [&](size_t i)
+  {
+    results[i].cost = make_plan(planner, starts[i], goals[i], results[i].plan, direction);
+  });
+  return results;
+}
@@ -0,0 +1,25 @@
+#include "goapDomain.h"
+
+goap::Planner goap::create_planner(std::span<const std::string_view> state_names,
+                                   std::span<const StaticAction> actions)
+{
+  Planner res = create_planner();
+  // names are only kept for printing, slots were resolved at compile time
+  for (size_t i = 0; i < state_names.size(); ++i)
+    res.wdesc.emplace(std::string(state_names[i]), i);
+  res.actions.reserve(actions.size());
+  for (const StaticAction &sact : actions)
+  {
+    Action &act = res.actions.emplace_back();
+    act.name = std::string(sact.name);
+    act.cost = sact.cost;
+    act.precondition = sact.precondition;
+    act.effect = sact.effect;
+    act.precondMask = sact.precondMask;
+    act.setMask = sact.setMask;
+    act.additiveEffect = sact.additiveEffect;
+    res.actionNames.emplace(act.name, res.actions.size() - 1);
+  }
+  compile_planner(res);
+  return res;
+}
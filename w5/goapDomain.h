@@ -0,0 +1,119 @@
+#pragma once
+#include <array>
+#include <initializer_list>
+#include <span>
+#include <string_view>
+#include <utility>
+
+#include "goapPlanner.h"
+
+namespace goap
+{
+  // State names of a domain known at compile time. Names are resolved to slots by the compiler,
+  // a misspelled one isn't a constant expression and fails the build instead of being skipped.
+  template<size_t NumStates>
+  struct StaticDomain
+  {
+    static_assert(NumStates <= WorldState::capacity, "too many states for a world state");
+
+    std::array<std::string_view, NumStates> names;
+
+    consteval size_t slot(std::string_view name) const
+    {
+      for (size_t i = 0; i < NumStates; ++i)
+        if (names[i] == name)
+          return i;
+      throw "unknown state name";
+    }
+  };
+
+  template<typename... Names>
+  consteval StaticDomain<sizeof...(Names)> make_domain(Names... names)
+  {
+    return {{std::string_view(names)...}};
+  }
+
+  using StaticStateDesc = std::pair<std::string_view, int>;
+
+  // action with its masks already packed, same layout as Action apart from the name
+  struct StaticAction
+  {
+    std::string_view name;
+    float cost = 1.f;
+
+    WorldState precondition;
+    WorldState effect;
+    WorldState precondMask;
+    WorldState setMask;
+    WorldState additiveEffect;
+  };
+
+  consteval int8_t static_state_value(int val)
+  {
+    if (val < -128 || val > 127)
+      throw "state value doesn't fit a slot";
+    return int8_t(val);
+  }
+
+  // unset slots are -1, i.e. don't matter when used as a goal
+  template<size_t NumStates>
+  consteval WorldState make_worldstate(const StaticDomain<NumStates> &domain,
+                                       std::initializer_list<StaticStateDesc> states)
+  {
+    WorldState res;
+    for (size_t i = 0; i < NumStates; ++i)
+      res.push_back(-1);
+    for (const StaticStateDesc &st : states)
+      res[domain.slot(st.first)] = static_state_value(st.second);
+    return res;
+  }
+
+  template<size_t NumStates>
+  consteval StaticAction make_action(const StaticDomain<NumStates> &domain, std::string_view name, float cost,
+                                     std::initializer_list<StaticStateDesc> precond,
+                                     std::initializer_list<StaticStateDesc> effect,
+                                     std::initializer_list<StaticStateDesc> additive_effect)
+  {
+    StaticAction res;
+    res.name = name;
+    res.cost = cost;
+    for (size_t i = 0; i < NumStates; ++i)
+    {
+      res.precondition.push_back(-1);
+      res.effect.push_back(-1);
+      res.precondMask.push_back(0);
+      res.setMask.push_back(0);
+      res.additiveEffect.push_back(0);
+    }
+    for (const StaticStateDesc &st : precond)
+    {
+      const size_t slot = domain.slot(st.first);
+      res.precondition[slot] = static_state_value(st.second);
+      res.precondMask[slot] = st.second < 0 ? 0 : -1;
+    }
+    for (const StaticStateDesc &st : effect)
+    {
+      const size_t slot = domain.slot(st.first);
+      res.effect[slot] = static_state_value(st.second);
+      res.setMask[slot] = st.second < 0 ? 0 : -1;
+      res.additiveEffect[slot] = 0;
+    }
+    for (const StaticStateDesc &st : additive_effect)
+    {
+      const size_t slot = domain.slot(st.first);
+      res.effect[slot] = static_state_value(st.second);
+      res.setMask[slot] = 0;
+      res.additiveEffect[slot] = static_state_value(st.second);
+    }
+    return res;
+  }
+
+  // planner with the actions copied as they are, its action index is compiled right away
+  Planner create_planner(std::span<const std::string_view> state_names, std::span<const StaticAction> actions);
+
+  template<size_t NumStates>
+  Planner create_planner(const StaticDomain<NumStates> &domain, std::span<const StaticAction> actions)
+  {
+    return create_planner(std::span<const std::string_view>(domain.names), actions);
+  }
+};
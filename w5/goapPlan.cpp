@@ -1,105 +1,569 @@
 #include "goapPlanner.h"
 #include <algorithm>
+#include <cfloat>
 
+template<typename State>
 struct PlanNode
 {
-  goap::WorldState worldState;
-  goap::WorldState prevState;
+  State worldState;
 
   float g = 0;
   float h = 0;
 
   size_t actionId;
+  size_t parent; // index of the previous node, size_t(-1) for the start
+  size_t order; // ties in f are broken by insertion order
+  bool closed = false;
 };
 
-static float heuristic(const goap::WorldState &from, const goap::WorldState &to)
+struct OpenEntry
 {
-  float cost = 0;
-  for (size_t i = 0; i < to.size(); ++i)
-    if (to[i] >= 0) // we care about it
-      cost += float(abs(to[i] - from[i]));
-  return cost;
-}
+  float f;
+  size_t order;
+  size_t node;
 
-static void reconstruct_plan(PlanNode &goal_node, const std::vector<PlanNode> &closed, std::vector<goap::PlanStep> &plan)
+  bool operator>(const OpenEntry &rhs) const { return f != rhs.f ? f > rhs.f : order > rhs.order; }
+};
+
+// Goal of the regressive search, slots with zero mask don't matter
+struct RegressState
 {
-  PlanNode &curNode = goal_node;
-  while (curNode.actionId != size_t(-1))
+  goap::WorldState values; // 0 for the slots that don't matter
+  goap::WorldState careMask;
+
+  bool operator==(const RegressState &) const = default;
+};
+
+struct RegressStateHash
+{
+  size_t operator()(const RegressState &st) const
   {
-    plan.push_back({curNode.actionId, curNode.worldState});
-    auto itf = std::find_if(closed.begin(), closed.end(), [&](const PlanNode &n) { return n.worldState == curNode.prevState; });
-    curNode = *itf;
+    const goap::WorldStateHash hash;
+    return hash(st.values) ^ (hash(st.careMask) * 31);
   }
-  std::reverse(plan.begin(), plan.end());
+};
+
+// Costs of moving a single slot between values with the rest of the domain ignored.
+// A projection never overestimates, so the largest of them is admissible, and so is their sum
+// once the cost of every action is split evenly between the slots it changes.
+struct SlotCosts
+{
+  static constexpr size_t num_values = 256;
+
+  std::vector<float> full; // [slot * num_values + uint8_t(value)], FLT_MAX if the value can't be reached
+  std::vector<float> shared; // same, with the split action costs
+  std::vector<float> sharedCost; // per action
+  goap::WorldState slots; // -1 for the slots the tables are built for
+  std::vector<std::pair<float, uint8_t>> openList;
+};
+
+static bool changes_slot(const goap::Action &action, size_t slot)
+{
+  return action.setMask[slot] != 0 || action.additiveEffect[slot] != 0;
 }
 
-float goap::make_plan(const Planner &planner, const WorldState &from, const WorldState &to, std::vector<PlanStep> &plan)
+// Dijkstra over the values of one slot, towards the target value if backward, from it otherwise.
+// Set effects without a precondition on the slot reach the target from any value, those are the cap.
+static void build_slot_costs(const goap::Planner &planner, const std::vector<float> &act_costs, size_t slot,
+                             int8_t anchor, bool backward, float *costs, std::vector<std::pair<float, uint8_t>> &open)
 {
-  std::vector<PlanNode> openList = {PlanNode{from, from, 0, heuristic(from, to), size_t(-1)}};
-  std::vector<PlanNode> closedList = {};
-  while (!openList.empty())
+  const std::greater<std::pair<float, uint8_t>> cmp;
+  std::fill(costs, costs + SlotCosts::num_values, FLT_MAX);
+  open.clear();
+  auto relax = [&](int8_t val, float cost)
+  {
+    if (cost >= costs[uint8_t(val)])
+      return;
+    costs[uint8_t(val)] = cost;
+    open.push_back({cost, uint8_t(val)});
+    std::push_heap(open.begin(), open.end(), cmp);
+  };
+  float anyValueCost = FLT_MAX;
+  relax(anchor, 0.f);
+  if (!backward)
+    for (size_t actId = 0; actId < planner.actions.size(); ++actId)
+    {
+      const goap::Action &action = planner.actions[actId];
+      if (action.setMask[slot] != 0 && action.precondMask[slot] == 0)
+        relax(action.effect[slot], act_costs[actId]);
+    }
+  while (!open.empty())
   {
-    auto minIt = openList.begin();
-    float minF = minIt->g + minIt->h;
-    for (auto it = openList.begin(); it != openList.end(); ++it)
-      if (it->g + it->h < minF)
+    std::pop_heap(open.begin(), open.end(), cmp);
+    const auto [cost, uval] = open.back();
+    open.pop_back();
+    if (cost > costs[uval])
+      continue;
+    if (cost >= anyValueCost)
+      break;
+    const int8_t val = int8_t(uval);
+    for (size_t actId = 0; actId < planner.actions.size(); ++actId)
+    {
+      const goap::Action &action = planner.actions[actId];
+      if (!changes_slot(action, slot))
+        continue;
+      const float nextCost = cost + act_costs[actId];
+      const bool hasPrecond = action.precondMask[slot] != 0;
+      if (backward)
+      {
+        if (action.setMask[slot] != 0)
+        {
+          if (action.effect[slot] != val)
+            continue;
+          if (hasPrecond)
+            relax(action.precondition[slot], nextCost);
+          else
+            anyValueCost = std::min(anyValueCost, nextCost);
+          continue;
+        }
+        const int8_t prev = int8_t(val - action.additiveEffect[slot]);
+        if (!hasPrecond || prev == action.precondition[slot])
+          relax(prev, nextCost);
+        continue;
+      }
+      if (hasPrecond && action.precondition[slot] != val)
+        continue;
+      if (action.setMask[slot] != 0)
       {
-        minF = it->g + it->h;
-        minIt = it;
+        if (hasPrecond)
+          relax(action.effect[slot], nextCost);
       }
-    PlanNode cur = *minIt;
-    openList.erase(minIt);
-    if (heuristic(cur.worldState, to) == 0) // we've reached our goal
+      else
+        relax(int8_t(val + action.additiveEffect[slot]), nextCost);
+    }
+  }
+  for (size_t i = 0; i < SlotCosts::num_values; ++i)
+    costs[i] = std::min(costs[i], anyValueCost);
+}
+
+// tables for the marked slots of the anchor, costs of reaching it if backward, of getting from it otherwise
+static void build_slot_costs(const goap::Planner &planner, const goap::WorldState &anchor,
+                             const goap::WorldState &slots, bool backward, SlotCosts &res)
+{
+  res.slots = slots;
+  res.full.resize(anchor.size() * SlotCosts::num_values);
+  res.shared.resize(anchor.size() * SlotCosts::num_values);
+  res.sharedCost.resize(planner.actions.size());
+  thread_local std::vector<float> fullCost;
+  fullCost.resize(planner.actions.size());
+  for (size_t actId = 0; actId < planner.actions.size(); ++actId)
+  {
+    size_t numChanged = 0;
+    for (size_t i = 0; i < anchor.size(); ++i)
+      if (slots[i] != 0 && changes_slot(planner.actions[actId], i))
+        numChanged++;
+    fullCost[actId] = goap::get_action_cost(planner, actId);
+    res.sharedCost[actId] = fullCost[actId] / float(std::max<size_t>(numChanged, 1));
+  }
+  for (size_t i = 0; i < anchor.size(); ++i)
+    if (slots[i] != 0)
     {
-      reconstruct_plan(cur, closedList, plan);
-      return minF;
+      build_slot_costs(planner, fullCost, i, anchor[i], backward, res.full.data() + i * SlotCosts::num_values,
+                       res.openList);
+      build_slot_costs(planner, res.sharedCost, i, anchor[i], backward,
+                       res.shared.data() + i * SlotCosts::num_values, res.openList);
     }
-    closedList.push_back(cur);
-    std::vector<size_t> transitions = find_valid_state_transitions(planner, cur.worldState);
-    //const bool firstIter = openList.empty();
-    //printf("------------\n");
-    for (size_t actId : transitions)
+}
+
+// values of the slots set in the mask are looked up
+static float slot_costs_estimate(const SlotCosts &costs, const goap::WorldState &values, const goap::WorldState &mask)
+{
+  float sum = 0.f;
+  float largest = 0.f;
+  for (size_t i = 0; i < values.size(); ++i)
+    if (mask[i] != 0 && costs.slots[i] != 0)
+    {
+      const size_t idx = i * SlotCosts::num_values + uint8_t(values[i]);
+      if (costs.full[idx] == FLT_MAX)
+        return FLT_MAX; // dead end
+      sum += costs.shared[idx];
+      largest = std::max(largest, costs.full[idx]);
+    }
+  return std::max(sum, largest);
+}
+
+static goap::WorldState goal_slots(const goap::WorldState &goal)
+{
+  goap::WorldState res;
+  for (size_t i = 0; i < goal.size(); ++i)
+    res.push_back(goal[i] >= 0 ? -1 : 0);
+  return res;
+}
+
+// Bump allocated search memory, kept per thread and reset between requests.
+// States are interned into nodes and the index refers to them by node index,
+// so once the buffers have grown a request doesn't touch the heap.
+template<typename State, typename StateHash>
+struct SearchArena
+{
+  std::vector<PlanNode<State>> nodes;
+  std::vector<uint32_t> table; // open addressing, node index + 1, 0 - empty slot
+  std::vector<OpenEntry> openList; // binary heap, smallest f on top
+  size_t closestNode = 0; // expanded node with the smallest h, end of the best partial plan
+
+  void reset()
+  {
+    nodes.clear();
+    openList.clear();
+    closestNode = 0;
+    std::fill(table.begin(), table.end(), 0u);
+  }
+
+  size_t find_slot(const State &st) const
+  {
+    const size_t mask = table.size() - 1;
+    for (size_t slot = StateHash()(st) & mask;; slot = (slot + 1) & mask)
+      if (table[slot] == 0 || nodes[table[slot] - 1].worldState == st)
+        return slot;
+  }
+
+  // node index of the state, inserted is set when the caller has to push a node with that index
+  size_t intern(const State &st, bool &inserted)
+  {
+    if ((nodes.size() + 1) * 2 > table.size())
     {
-      //printf("valid action: %s\n", planner.actions[actId].name.c_str());
-      WorldState st = apply_action(planner, actId, cur.worldState);
-      const float score = cur.g + get_action_cost(planner, actId);
-      auto openIt = std::find_if(openList.begin(), openList.end(), [&](const PlanNode &n) { return st == n.worldState; });
-      auto closeIt = std::find_if(closedList.begin(), closedList.end(), [&](const PlanNode &n) { return st == n.worldState; });
-      if (openIt != openList.end() && score < openIt->g)
+      table.assign(std::max<size_t>(table.size() * 2, 64), 0u);
+      for (size_t i = 0; i < nodes.size(); ++i)
+        table[find_slot(nodes[i].worldState)] = uint32_t(i + 1);
+    }
+    const size_t slot = find_slot(st);
+    inserted = table[slot] == 0;
+    if (inserted)
+      table[slot] = uint32_t(nodes.size() + 1);
+    return table[slot] - 1;
+  }
+};
+
+template<typename State, typename StateHash, typename Heuristic>
+static void astar_start(const State &start, Heuristic heur, SearchArena<State, StateHash> &arena)
+{
+  arena.reset();
+  bool inserted = false;
+  arena.intern(start, inserted);
+  arena.nodes.push_back(PlanNode<State>{start, 0, heur(start), size_t(-1), size_t(-1), 0});
+  // open entries are never removed, outdated ones are skipped when popped
+  arena.openList.push_back({arena.nodes[0].h, 0, 0});
+}
+
+// A* from the state of the arena, expand(state, push) calls push(action, next_state) for every neighbour.
+// Returns index of the goal node in arena.nodes or size_t(-1) if there's no plan
+// or max_expanded nodes were expanded, the search can be continued in the latter case.
+template<typename State, typename StateHash, typename Expand, typename Heuristic, typename IsGoal>
+static size_t astar_continue(Expand expand, Heuristic heur, IsGoal is_goal, SearchArena<State, StateHash> &arena,
+                             goap::PlanStats *stats, size_t max_expanded = size_t(-1))
+{
+  std::vector<PlanNode<State>> &nodes = arena.nodes;
+  std::vector<OpenEntry> &openList = arena.openList;
+  const std::greater<OpenEntry> cmp;
+  bool inserted = false;
+  while (!openList.empty())
+  {
+    std::pop_heap(openList.begin(), openList.end(), cmp);
+    const OpenEntry top = openList.back();
+    openList.pop_back();
+    if (nodes[top.node].closed || top.f != nodes[top.node].g + nodes[top.node].h)
+      continue;
+    const size_t curIdx = top.node;
+    if (is_goal(nodes[curIdx].worldState))
+      return curIdx;
+    if (max_expanded-- == 0)
+    {
+      openList.push_back(top);
+      std::push_heap(openList.begin(), openList.end(), cmp);
+      return size_t(-1);
+    }
+    nodes[curIdx].closed = true;
+    if (nodes[curIdx].h < nodes[arena.closestNode].h)
+      arena.closestNode = curIdx;
+    if (stats)
+      stats->expandedNodes++;
+    const State curState = nodes[curIdx].worldState;
+    const float curG = nodes[curIdx].g;
+    expand(curState, [&](size_t actId, float cost, const State &st)
+    {
+      const float score = curG + cost;
+      const size_t nodeIdx = arena.intern(st, inserted);
+      if (inserted)
       {
-        openIt->g = score;
-        openIt->prevState = cur.worldState;
+        const float h = heur(st);
+        nodes.push_back({st, score, h, actId, curIdx, nodes.size()});
+        openList.push_back({score + h, nodes.back().order, nodeIdx});
+        std::push_heap(openList.begin(), openList.end(), cmp);
+        return;
       }
-      if (closeIt != closedList.end() && score < closeIt->g)
+      PlanNode<State> &node = nodes[nodeIdx];
+      if (score < node.g)
       {
-        closeIt->g = score;
-        closeIt->prevState = cur.worldState;
+        // closed nodes get the better parent but aren't expanded again
+        node.g = score;
+        node.parent = curIdx;
+        node.actionId = actId;
+        if (!node.closed)
+        {
+          openList.push_back({score + node.h, node.order, nodeIdx});
+          std::push_heap(openList.begin(), openList.end(), cmp);
+        }
       }
-      if (closeIt == closedList.end() && openIt == openList.end())
-        openList.push_back({st, cur.worldState, score, heuristic(st, to), actId});
+    });
+  }
+  return size_t(-1);
+}
+
+// returns index of the goal node in arena.nodes or size_t(-1) if there's no plan
+template<typename State, typename StateHash, typename Expand, typename Heuristic, typename IsGoal>
+static size_t astar_search(const State &start, Expand expand, Heuristic heur, IsGoal is_goal,
+                           SearchArena<State, StateHash> &arena, goap::PlanStats *stats,
+                           size_t max_expanded = size_t(-1))
+{
+  astar_start(start, heur, arena);
+  return astar_continue(expand, heur, is_goal, arena, stats, max_expanded);
+}
+
+// state before the action that satisfies the goal after it, false if the action doesn't help or conflicts
+static bool regress_action(const goap::Action &action, const RegressState &goal, RegressState &res)
+{
+  bool relevant = false;
+  res = goal;
+  for (size_t i = 0; i < goal.values.size(); ++i)
+  {
+    const bool cares = goal.careMask[i] != 0;
+    const bool hasPrecond = action.precondMask[i] != 0;
+    if (action.setMask[i] != 0)
+    {
+      if (cares && goal.values[i] != action.effect[i])
+        return false;
+      relevant |= cares;
+      // the value before the action is only limited by the precondition
+      res.careMask[i] = hasPrecond ? -1 : 0;
+      res.values[i] = hasPrecond ? action.precondition[i] : 0;
+      continue;
+    }
+    int8_t required = goal.values[i];
+    if (cares && action.additiveEffect[i] != 0)
+    {
+      required = int8_t(goal.values[i] - action.additiveEffect[i]);
+      relevant = true;
+    }
+    if (hasPrecond)
+    {
+      if (cares && required != action.precondition[i])
+        return false;
+      res.careMask[i] = -1;
+      res.values[i] = action.precondition[i];
     }
+    else
+      res.values[i] = required;
   }
-  return 0.f;
+  return relevant;
+}
+
+template<typename Push>
+static void expand_forward(const goap::Planner &planner, const goap::WorldState &cur, std::vector<size_t> &transitions,
+                           Push push)
+{
+  goap::find_valid_state_transitions(planner, cur, transitions);
+  for (size_t actId : transitions)
+    push(actId, goap::get_action_cost(planner, actId), goap::apply_action(planner, actId, cur));
+}
+
+template<typename State, typename StateHash>
+static void collect_plan(const SearchArena<State, StateHash> &arena, size_t last, std::vector<goap::PlanStep> &plan)
+{
+  const std::vector<PlanNode<State>> &nodes = arena.nodes;
+  for (size_t idx = last; nodes[idx].parent != size_t(-1); idx = nodes[idx].parent)
+    plan.push_back({nodes[idx].actionId, nodes[idx].worldState});
+  std::reverse(plan.begin(), plan.end());
+}
+
+// returns cost of the plan or a negative value if there's none
+static float make_forward_plan(const goap::Planner &planner, const goap::WorldState &from, const goap::WorldState &to,
+                               std::vector<goap::PlanStep> &plan, goap::PlanStats *stats,
+                               size_t max_expanded = size_t(-1))
+{
+  thread_local std::vector<size_t> transitions;
+  auto expand = [&](const goap::WorldState &cur, auto push) { expand_forward(planner, cur, transitions, push); };
+  thread_local SlotCosts costs;
+  build_slot_costs(planner, to, goal_slots(to), true, costs);
+  auto heur = [&](const goap::WorldState &st) { return slot_costs_estimate(costs, st, costs.slots); };
+  auto is_goal = [&](const goap::WorldState &st) { return goap::is_goal_reached(st, to); };
+  thread_local SearchArena<goap::WorldState, goap::WorldStateHash> arena;
+  const size_t goalNode = astar_search(from, expand, heur, is_goal, arena, stats, max_expanded);
+  if (goalNode == size_t(-1))
+    return -1.f;
+  collect_plan(arena, goalNode, plan);
+  return arena.nodes[goalNode].g;
+}
+
+// searches from the goal back to the current state, every node is a set of conditions still to satisfy
+static float make_regressive_plan(const goap::Planner &planner, const goap::WorldState &from,
+                                  const goap::WorldState &to, std::vector<goap::PlanStep> &plan,
+                                  goap::PlanStats *stats)
+{
+  RegressState goal;
+  for (size_t i = 0; i < to.size(); ++i)
+  {
+    goal.values.push_back(to[i] >= 0 ? to[i] : 0);
+    goal.careMask.push_back(to[i] >= 0 ? -1 : 0);
+  }
+  auto expand = [&](const RegressState &cur, auto push)
+  {
+    RegressState prev;
+    for (size_t actId = 0; actId < planner.actions.size(); ++actId)
+      if (regress_action(planner.actions[actId], cur, prev))
+        push(actId, goap::get_action_cost(planner, actId), prev);
+  };
+  // every slot may become a condition, so the tables are built from the current state for all of them
+  thread_local SlotCosts costs;
+  build_slot_costs(planner, from, goal_slots(from), false, costs);
+  auto heur = [&](const RegressState &st) { return slot_costs_estimate(costs, st.values, st.careMask); };
+  auto is_goal = [&](const RegressState &st)
+  {
+    for (size_t i = 0; i < st.values.size(); ++i)
+      if (st.careMask[i] != 0 && st.values[i] != from[i])
+        return false;
+    return true;
+  };
+  thread_local SearchArena<RegressState, RegressStateHash> arena;
+  const size_t startNode = astar_search(goal, expand, heur, is_goal, arena, stats);
+  const std::vector<PlanNode<RegressState>> &nodes = arena.nodes;
+  if (startNode == size_t(-1))
+    return 0.f;
+  // parents lead towards the goal, so walking them gives actions in execution order
+  goap::WorldState st = from;
+  for (size_t idx = startNode; nodes[idx].parent != size_t(-1); idx = nodes[idx].parent)
+  {
+    st = goap::apply_action(planner, nodes[idx].actionId, st);
+    plan.push_back({nodes[idx].actionId, st});
+  }
+  return nodes[startNode].g;
+}
+
+float goap::make_plan(const Planner &planner, const WorldState &from, const WorldState &to, std::vector<PlanStep> &plan,
+                      PlanDirection direction, PlanStats *stats)
+{
+  if (direction == PlanDirection::Regressive)
+    return make_regressive_plan(planner, from, to, plan, stats);
+  return std::max(make_forward_plan(planner, from, to, plan, stats), 0.f);
+}
+
+bool goap::make_bounded_plan(const Planner &planner, const WorldState &from, const WorldState &to, size_t max_expanded,
+                             std::vector<PlanStep> &plan)
+{
+  return make_forward_plan(planner, from, to, plan, nullptr, max_expanded) >= 0.f;
+}
+
+struct goap::PlanSearch::Data
+{
+  const Planner &planner;
+  WorldState to;
+  SlotCosts costs;
+  SearchArena<WorldState, WorldStateHash> arena;
+  std::vector<size_t> transitions;
+  PlanStats stats;
+  size_t goalNode = size_t(-1);
+  SearchStatus status = SearchStatus::Searching;
+};
+
+goap::PlanSearch::PlanSearch(const Planner &planner, const WorldState &from, const WorldState &to)
+  : data(new Data{planner, to, {}, {}, {}, {}})
+{
+  build_slot_costs(planner, to, goal_slots(to), true, data->costs);
+  astar_start(from, [&](const WorldState &st) { return slot_costs_estimate(data->costs, st, data->costs.slots); },
+              data->arena);
+}
+
+goap::PlanSearch::~PlanSearch() = default;
+goap::PlanSearch::PlanSearch(PlanSearch &&) noexcept = default;
+goap::PlanSearch &goap::PlanSearch::operator=(PlanSearch &&) noexcept = default;
+
+goap::SearchStatus goap::PlanSearch::step(size_t budget_nodes)
+{
+  Data &d = *data;
+  if (d.status != SearchStatus::Searching)
+    return d.status;
+  auto expand = [&](const WorldState &cur, auto push) { expand_forward(d.planner, cur, d.transitions, push); };
+  auto heur = [&](const WorldState &st) { return slot_costs_estimate(d.costs, st, d.costs.slots); };
+  auto is_goal = [&](const WorldState &st) { return is_goal_reached(st, d.to); };
+  d.goalNode = astar_continue(expand, heur, is_goal, d.arena, &d.stats, budget_nodes);
+  if (d.goalNode != size_t(-1))
+    d.status = SearchStatus::Found;
+  else if (d.arena.openList.empty())
+    d.status = SearchStatus::NoPlan;
+  return d.status;
 }
 
-float ida_star_search(const goap::Planner &planner, std::vector<goap::PlanStep> &path, const float g, const float bound, const goap::WorldState &to)
+goap::SearchStatus goap::PlanSearch::status() const
 {
+  return data->status;
+}
+
+size_t goap::PlanSearch::expanded_nodes() const
+{
+  return data->stats.expandedNodes;
+}
+
+float goap::PlanSearch::progress() const
+{
+  const Data &d = *data;
+  if (d.status == SearchStatus::Found)
+    return 1.f;
+  const float startH = d.arena.nodes[0].h;
+  if (startH <= 0.f || startH == FLT_MAX)
+    return 0.f;
+  return 1.f - d.arena.nodes[d.arena.closestNode].h / startH;
+}
+
+float goap::PlanSearch::get_plan(std::vector<PlanStep> &plan) const
+{
+  const Data &d = *data;
+  const size_t last = d.status == SearchStatus::Found ? d.goalNode : d.arena.closestNode;
+  plan.clear();
+  collect_plan(d.arena, last, plan);
+  return d.arena.nodes[last].g;
+}
+
+bool goap::is_goal_reached(const WorldState &st, const WorldState &goal)
+{
+  for (size_t i = 0; i < goal.size(); ++i)
+    if (goal[i] >= 0 && st[i] != goal[i])
+      return false;
+  return true;
+}
+
+// path, a transition buffer per depth and heuristic tables, reused between requests of the thread
+struct IdaArena
+{
+  std::vector<goap::PlanStep> path;
+  std::vector<std::vector<size_t>> transitions;
+  std::unordered_map<goap::WorldState, float, goap::WorldStateHash> bestG; // per iteration, smallest g a state was entered with
+  SlotCosts costs;
+};
+
+static float ida_star_search(const goap::Planner &planner, IdaArena &arena, const float g, const float bound, const goap::WorldState &to)
+{
+  std::vector<goap::PlanStep> &path = arena.path;
   const goap::PlanStep s = path.back();
-  const float f = g + heuristic(s.worldState, to);
+  const float h = slot_costs_estimate(arena.costs, s.worldState, arena.costs.slots);
+  if (h == FLT_MAX)
+    return FLT_MAX; // dead end, the goal can't be reached from here whatever the bound is
+  const float f = g + h;
   if (f > bound)
     return f;
-  if (heuristic(s.worldState, to) == 0)
+  if (goap::is_goal_reached(s.worldState, to))
     return -f;
   float min = FLT_MAX;
   auto checkNeighbour = [&](size_t actId) -> float
   {
     goap::WorldState st = goap::apply_action(planner, actId, s.worldState);
-    if (std::find_if(path.begin(), path.end(), [&](const goap::PlanStep &rhs)
-                     { return st == rhs.worldState; }) != path.end())
+    float gScore = g + goap::get_action_cost(planner, actId);
+    // a state entered before in this iteration with no larger g has its subtree searched already,
+    // the states on the path are among them, so cycles are skipped as well
+    auto [it, inserted] = arena.bestG.try_emplace(st, gScore);
+    if (!inserted && it->second <= gScore)
       return 0.f;
+    it->second = gScore;
     path.push_back({ actId, st });
-    float gScore = g + goap::get_action_cost(planner, actId);
-    const float t = ida_star_search(planner, path, gScore, bound, to);
+    const float t = ida_star_search(planner, arena, gScore, bound, to);
     if (t < 0.f)
       return t;
     if (t < min)
@@ -108,10 +572,14 @@ float ida_star_search(const goap::Planner &planner, std::vector<goap::PlanStep>
     return t;
   };
 
-  std::vector<size_t> transitions = find_valid_state_transitions(planner, s.worldState);
-  for (size_t actId : transitions)
+  const size_t depth = path.size();
+  if (arena.transitions.size() < depth)
+    arena.transitions.resize(depth);
+  find_valid_state_transitions(planner, s.worldState, arena.transitions[depth - 1]);
+  // deeper calls may resize the outer vector, so the list is looked up again after each of them
+  for (size_t i = 0; i < arena.transitions[depth - 1].size(); ++i)
   {
-    float val = checkNeighbour(actId);
+    float val = checkNeighbour(arena.transitions[depth - 1][i]);
     if (val < 0.f) return val;
   }
   return min;
@@ -119,22 +587,29 @@ float ida_star_search(const goap::Planner &planner, std::vector<goap::PlanStep>
 
 void goap::make_plan_ida_star(const Planner &planner, const WorldState &from, const WorldState &to, std::vector<PlanStep> &plan)
 {
-  float bound = heuristic(from, to);
-  std::vector<PlanStep> path = {{size_t(-1), from}};
+  thread_local IdaArena arena;
+  build_slot_costs(planner, to, goal_slots(to), true, arena.costs);
+  float bound = slot_costs_estimate(arena.costs, from, arena.costs.slots);
+  plan.clear();
+  if (bound == FLT_MAX)
+    return; // start is a dead end, searching without a bound would only walk every path
+  arena.path.clear();
+  arena.path.push_back({size_t(-1), from});
   while (true)
   {
-    const float t = ida_star_search(planner, path, 0.f, bound, to);
+    arena.bestG.clear();
+    arena.bestG.emplace(from, 0.f);
+    const float t = ida_star_search(planner, arena, 0.f, bound, to);
     if (t < 0.f)
     {
-      plan = std::move(path);
+      plan.assign(arena.path.begin(), arena.path.end());
       return;
     }
     if (t == FLT_MAX)
       break;
     bound = t;
-    printf("new bound %0.1f\n", bound);
   }
-  plan = {};
+  plan.clear();
 }
 
 void goap::print_plan(const Planner &planner, const WorldState &init, const std::vector<PlanStep> &plan)
@@ -162,7 +637,7 @@ void goap::print_plan(const Planner &planner, const WorldState &init, const std:
   for (const PlanStep &step : plan)
   {
     // Just to skip the initial world state because it's the first step in the plan in case of ida_star
-    if (heuristic(step.worldState, init) == 0)
+    if (is_goal_reached(step.worldState, init))
       continue;
 
     printf("%15s: ", planner.actions[step.action].name.c_str());
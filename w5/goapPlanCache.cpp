@@ -0,0 +1,49 @@
+#include "goapPlanCache.h"
+
+goap::PlanCache::PlanCache(size_t capacity) : capacity(capacity)
+{
+}
+
+float goap::PlanCache::make_plan(const Planner &planner, const WorldState &from, const WorldState &to,
+                                 std::vector<PlanStep> &plan)
+{
+  Key key{&planner, from, to};
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto itf = index.find(key);
+    if (itf != index.end())
+    {
+      if (itf->second->plannerVersion == planner.version)
+      {
+        entries.splice(entries.begin(), entries, itf->second);
+        plan = itf->second->plan;
+        return itf->second->cost;
+      }
+      entries.erase(itf->second);
+      index.erase(itf);
+    }
+  }
+
+  // planning is done without the lock, so other agents don't wait for it
+  plan.clear();
+  const float cost = goap::make_plan(planner, from, to, plan);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (index.find(key) != index.end())
+    return cost; // someone else planned the same request meanwhile
+  entries.push_front(Entry{key, planner.version, cost, plan});
+  index.emplace(std::move(key), entries.begin());
+  while (entries.size() > capacity)
+  {
+    index.erase(entries.back().key);
+    entries.pop_back();
+  }
+  return cost;
+}
+
+void goap::PlanCache::clear()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  entries.clear();
+  index.clear();
+}
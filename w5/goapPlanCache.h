@@ -0,0 +1,52 @@
+#pragma once
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "goapPlanner.h"
+
+namespace goap
+{
+  // Memoized make_plan results shared between agents, safe to use from several threads.
+  // Least recently used plans are evicted, plans made before the planner changed are rebuilt.
+  class PlanCache
+  {
+    struct Key
+    {
+      const Planner *planner;
+      WorldState from;
+      WorldState to;
+
+      bool operator==(const Key &) const = default;
+    };
+
+    struct KeyHash
+    {
+      size_t operator()(const Key &key) const
+      {
+        const WorldStateHash hash;
+        return hash(key.from) ^ (hash(key.to) * 31) ^ std::hash<const Planner *>()(key.planner);
+      }
+    };
+
+    struct Entry
+    {
+      Key key;
+      uint32_t plannerVersion;
+      float cost;
+      std::vector<PlanStep> plan;
+    };
+
+    size_t capacity;
+    std::list<Entry> entries; // most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+    std::mutex mutex;
+
+  public:
+    explicit PlanCache(size_t capacity);
+
+    float make_plan(const Planner &planner, const WorldState &from, const WorldState &to, std::vector<PlanStep> &plan);
+    void clear();
+  };
+};
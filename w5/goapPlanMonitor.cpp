@@ -0,0 +1,61 @@
+#include "goapPlanMonitor.h"
+#include <algorithm>
+
+// applies steps to the state and refreshes the states they lead to,
+// returns the first step that can't be done, st is left as the state before it
+static size_t simulate_plan(const goap::Planner &planner, goap::WorldState &st, std::vector<goap::PlanStep> &plan)
+{
+  for (size_t i = 0; i < plan.size(); ++i)
+  {
+    if (!goap::is_action_valid(planner, plan[i].action, st))
+      return i;
+    st = goap::apply_action(planner, plan[i].action, st);
+    plan[i].worldState = st;
+  }
+  return plan.size();
+}
+
+float goap::start_plan(const Planner &planner, PlanMonitor &monitor, const WorldState &from, const WorldState &goal)
+{
+  monitor.goal = goal;
+  monitor.plan.clear();
+  monitor.nextStep = 0;
+  return make_plan(planner, from, goal, monitor.plan);
+}
+
+goap::PlanStatus goap::update_plan(const Planner &planner, PlanMonitor &monitor, const WorldState &current)
+{
+  std::vector<PlanStep> &plan = monitor.plan;
+  plan.erase(plan.begin(), plan.begin() + ptrdiff_t(std::min(monitor.nextStep, plan.size())));
+  monitor.nextStep = 0;
+
+  WorldState st = current;
+  const size_t failed = simulate_plan(planner, st, plan);
+  if (failed == plan.size() && is_goal_reached(st, monitor.goal))
+    return PlanStatus::Valid;
+
+  // bridge from where the plan broke to what the broken step (or the goal) needs, the rest is kept
+  const WorldState &target = failed < plan.size() ? planner.actions[plan[failed].action].precondition : monitor.goal;
+  std::vector<PlanStep> patch;
+  if (make_bounded_plan(planner, st, target, monitor.repairBudget, patch))
+  {
+    plan.insert(plan.begin() + ptrdiff_t(failed), patch.begin(), patch.end());
+    st = current;
+    if (simulate_plan(planner, st, plan) == plan.size() && is_goal_reached(st, monitor.goal))
+      return PlanStatus::Repaired;
+  }
+
+  plan.clear();
+  make_plan(planner, current, monitor.goal, plan);
+  return plan.empty() ? PlanStatus::Failed : PlanStatus::Replanned;
+}
+
+size_t goap::next_plan_action(const PlanMonitor &monitor)
+{
+  return monitor.nextStep < monitor.plan.size() ? monitor.plan[monitor.nextStep].action : size_t(-1);
+}
+
+void goap::complete_plan_step(PlanMonitor &monitor)
+{
+  monitor.nextStep++;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <vector>
+
+#include "goapPlanner.h"
+
+namespace goap
+{
+  enum class PlanStatus
+  {
+    Valid,
+    Repaired, // a short sub-plan was spliced in before the step that broke
+    Replanned,
+    Failed
+  };
+
+  // Plan of an agent kept between turns. Every turn the rest of it is checked against the actual
+  // world state and, when the world drifted away from it, patched locally before replanning from scratch.
+  struct PlanMonitor
+  {
+    WorldState goal;
+    std::vector<PlanStep> plan;
+    size_t nextStep = 0;
+    size_t repairBudget = 64; // node expansions a local repair may take
+  };
+
+  float start_plan(const Planner &planner, PlanMonitor &monitor, const WorldState &from, const WorldState &goal);
+  PlanStatus update_plan(const Planner &planner, PlanMonitor &monitor, const WorldState &current);
+  // action of the next step or size_t(-1) if the plan is over
+  size_t next_plan_action(const PlanMonitor &monitor);
+  void complete_plan_step(PlanMonitor &monitor);
+};
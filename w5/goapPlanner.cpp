@@ -1,14 +1,32 @@
 #include "goapPlanner.h"
+#include <bit>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+static std::atomic<uint32_t> plannerVersion = 0;
 
 goap::Planner goap::create_planner()
 {
-  return Planner();
+  Planner res;
+  res.version = ++plannerVersion;
+  return res;
 }
 
 void goap::add_states_to_planner(Planner &planner, const std::vector<std::string> &state_names)
 {
   for (const std::string &name : state_names)
+  {
+    // a state without a slot would make actions and goals using it plan against nothing, the planner is unusable
+    if (planner.wdesc.size() == goap::WorldState::capacity && planner.wdesc.count(name) == 0)
+    {
+      fprintf(stderr, "goap: state '%s' doesn't fit, world states hold %zu states\n", name.c_str(),
+              goap::WorldState::capacity);
+      abort();
+    }
     planner.wdesc.emplace(name, planner.wdesc.size());
+  }
+  planner.version = ++plannerVersion;
 }
 
 
@@ -26,6 +44,7 @@ void goap::add_action_to_planner(Planner &planner, const char *name, float cost,
 
   planner.actionNames.emplace(name, planner.actions.size());
   planner.actions.emplace_back(act);
+  planner.version = ++plannerVersion;
 }
 
 static void set_planner_worldstate(const goap::Planner &planner, goap::WorldState &st, const char *st_name, int8_t val)
@@ -51,33 +70,86 @@ float goap::get_action_cost(const Planner &planner, size_t act_id)
   return planner.actions[act_id].cost;
 }
 
+static bool is_action_valid(const goap::Action &action, const goap::WorldState &from)
+{
+  uint64_t diff = 0;
+  for (size_t i = 0; i < goap::WorldState::num_words; ++i)
+    diff |= (from.word(i) ^ action.precondition.word(i)) & action.precondMask.word(i);
+  return diff == 0;
+}
+
+void goap::compile_planner(Planner &planner)
+{
+  ActionIndex &index = planner.actionIndex;
+  index.slots.clear();
+  index.numActions = planner.actions.size();
+  index.numWords = (index.numActions + 63) / 64;
+  for (size_t slot = 0; slot < planner.wdesc.size(); ++slot)
+    for (const Action &action : planner.actions)
+      if (action.precondMask[slot] != 0)
+      {
+        index.slots.push_back(slot);
+        break;
+      }
+
+  index.compatible.assign(index.slots.size() * 256 * index.numWords, 0);
+  for (size_t i = 0; i < index.slots.size(); ++i)
+    for (size_t val = 0; val < 256; ++val)
+    {
+      uint64_t *masks = &index.compatible[(i * 256 + val) * index.numWords];
+      for (size_t actId = 0; actId < planner.actions.size(); ++actId)
+      {
+        const Action &action = planner.actions[actId];
+        if (action.precondMask[index.slots[i]] == 0 || uint8_t(action.precondition[index.slots[i]]) == val)
+          masks[actId / 64] |= uint64_t(1) << (actId % 64);
+      }
+    }
+}
+
+bool goap::is_action_valid(const Planner &planner, size_t act, const WorldState &from)
+{
+  return ::is_action_valid(planner.actions[act], from);
+}
+
 std::vector<size_t> goap::find_valid_state_transitions(const Planner &planner, const WorldState &from)
 {
   std::vector<size_t> res;
+  find_valid_state_transitions(planner, from, res);
+  return res;
+}
 
-  for (size_t i = 0; i < planner.actions.size(); ++i)
+void goap::find_valid_state_transitions(const Planner &planner, const WorldState &from, std::vector<size_t> &res)
+{
+  res.clear();
+  const ActionIndex &index = planner.actionIndex;
+  if (index.numActions != planner.actions.size())
   {
-    const Action &action = planner.actions[i];
-    bool isValidAction = true;
-    for (size_t j = 0; j < action.precondition.size() && isValidAction; ++j)
-      isValidAction &= action.precondition[j] < 0 || from[j] == action.precondition[j];
-    if (isValidAction)
-      res.emplace_back(i);
+    // not compiled or actions were added after that
+    for (size_t i = 0; i < planner.actions.size(); ++i)
+      if (::is_action_valid(planner.actions[i], from))
+        res.emplace_back(i);
+    return;
+  }
+  for (size_t w = 0; w < index.numWords; ++w)
+  {
+    const size_t actionsLeft = index.numActions - w * 64;
+    uint64_t mask = actionsLeft >= 64 ? ~uint64_t(0) : (uint64_t(1) << actionsLeft) - 1;
+    for (size_t i = 0; i < index.slots.size() && mask != 0; ++i)
+      mask &= index.compatible[(i * 256 + uint8_t(from[index.slots[i]])) * index.numWords + w];
+    for (; mask != 0; mask &= mask - 1)
+      res.emplace_back(w * 64 + size_t(std::countr_zero(mask)));
   }
-  return res;
 }
 
 goap::WorldState goap::apply_action(const Planner &planner, size_t act, WorldState from)
 {
   WorldState res = from;
   const Action &action = planner.actions[act];
-  for (size_t i = 0; i < action.effect.size(); ++i)
+  for (size_t i = 0; i < WorldState::num_words; ++i)
   {
-    if (!action.setBitset[i])
-      res[i] += action.effect[i];
-    else if (action.effect[i] >= 0)
-      res[i] = action.effect[i];
+    const uint64_t mask = action.setMask.word(i);
+    const uint64_t blended = (from.word(i) & ~mask) | (action.effect.word(i) & mask);
+    res.set_word(i, add_slots(blended, action.additiveEffect.word(i)));
   }
   return res;
 }
-
@@ -1,7 +1,9 @@
 #pragma once
+#include <memory>
 #include <unordered_map>
 #include <vector>
 #include <string>
+#include <span>
 
 #include "goapWorldState.h"
 #include "goapAction.h"
@@ -9,14 +11,28 @@
 namespace goap
 {
 
+  // For every constrained slot and each of its 256 values, a bitmask of actions allowed by it,
+  // valid actions for a state are the AND of the masks of its slot values
+  struct ActionIndex
+  {
+    std::vector<size_t> slots; // slots constrained by at least one action
+    size_t numWords = 0;
+    size_t numActions = 0;
+    std::vector<uint64_t> compatible; // [slot][value][word]
+  };
+
   struct Planner
   {
     WorldDesc wdesc;
     std::vector<Action> actions;
     std::unordered_map<std::string, size_t> actionNames;
+    ActionIndex actionIndex;
+    uint32_t version = 0; // unique stamp, changes every time states or actions are added
   };
 
   Planner create_planner();
+  // builds the action index, call after all actions are added, otherwise actions are checked one by one
+  void compile_planner(Planner &planner);
 
   using StateDesc = std::pair<const char*, int>;
   using Precond = std::vector<StateDesc>;
@@ -27,13 +43,19 @@ namespace goap
                                                                              const Effect &effect,
                                                                              const Effect &additive_effect);
 
+  // aborts if the states don't fit into WorldState::capacity slots
   void add_states_to_planner(Planner &planner, const std::vector<std::string> &state_names);
   WorldState produce_planner_worldstate(const Planner &planner, const WorldStateList &states);
 
   float get_action_cost(const Planner &planner, size_t act_id);
 
   std::vector<size_t> find_valid_state_transitions(const Planner &planner, const WorldState &from);
+  // same, but fills a buffer that can be reused between calls
+  void find_valid_state_transitions(const Planner &planner, const WorldState &from, std::vector<size_t> &res);
   WorldState apply_action(const Planner &planner, size_t act, WorldState from);
+  bool is_action_valid(const Planner &planner, size_t act, const WorldState &from);
+  // slots of the goal set to -1 don't matter
+  bool is_goal_reached(const WorldState &st, const WorldState &goal);
 
   struct PlanStep
   {
@@ -41,7 +63,66 @@ namespace goap
     WorldState worldState;
   };
 
-  float make_plan(const Planner &planner, const WorldState &from, const WorldState &to, std::vector<PlanStep> &plan);
+  // forward search goes from the current state, regressive one from the goal conditions back to it
+  enum class PlanDirection
+  {
+    Forward,
+    Regressive
+  };
+
+  struct PlanStats
+  {
+    size_t expandedNodes = 0;
+  };
+
+  float make_plan(const Planner &planner, const WorldState &from, const WorldState &to, std::vector<PlanStep> &plan,
+                  PlanDirection direction = PlanDirection::Forward, PlanStats *stats = nullptr);
+  // forward search that gives up after max_expanded nodes, false if no plan was found within them
+  bool make_bounded_plan(const Planner &planner, const WorldState &from, const WorldState &to, size_t max_expanded,
+                         std::vector<PlanStep> &plan);
+
+  enum class SearchStatus
+  {
+    Searching,
+    Found,
+    NoPlan
+  };
+
+  // Forward search spread over several calls, so an expensive plan doesn't stall a frame.
+  // Open and closed sets are kept between steps, the planner has to outlive the search.
+  class PlanSearch
+  {
+    struct Data;
+    std::unique_ptr<Data> data;
+
+  public:
+    PlanSearch(const Planner &planner, const WorldState &from, const WorldState &to);
+    ~PlanSearch();
+
+    PlanSearch(PlanSearch &&) noexcept;
+    PlanSearch &operator=(PlanSearch &&) noexcept;
+
+    // expands at most budget_nodes nodes
+    SearchStatus step(size_t budget_nodes);
+    SearchStatus status() const;
+    size_t expanded_nodes() const;
+    // 0 at the start and 1 at the goal, by the heuristic of the closest state expanded so far
+    float progress() const;
+    // the plan once it's found, before that the best partial plan, which leads to the closest state, returns its cost
+    float get_plan(std::vector<PlanStep> &plan) const;
+  };
+
+  struct PlanResult
+  {
+    float cost = 0.f;
+    std::vector<PlanStep> plan;
+  };
+
+  // plans every (starts[i], goals[i]) pair on worker threads, results are in the input order
+  std::vector<PlanResult> plan_batch(const Planner &planner, std::span<const WorldState> starts,
+                                     std::span<const WorldState> goals,
+                                     PlanDirection direction = PlanDirection::Forward);
+
   void make_plan_ida_star(const Planner &planner, const WorldState &from, const WorldState &to, std::vector<PlanStep> &plan);
   void print_plan(const Planner &planner, const WorldState &init, const std::vector<PlanStep> &plan);
 };
@@ -1,11 +1,66 @@
 #pragma once
-#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
 #include <unordered_map>
 #include <string>
 
 namespace goap
 {
-  using WorldState = std::vector<int8_t>;
+  // Fixed capacity world state, slots are bytes packed into a few 64 bit words.
+  // Copies don't allocate and actions are checked and applied a word at a time.
+  struct WorldState
+  {
+    static constexpr size_t capacity = 32;
+    static constexpr size_t num_words = capacity / sizeof(uint64_t);
+
+    alignas(uint64_t) std::array<int8_t, capacity> values = {}; // unused slots stay 0
+    size_t count = 0;
+
+    constexpr size_t size() const { return count; }
+    constexpr void push_back(int8_t val)
+    {
+      assert(count < capacity && "world state is full");
+      if (count < capacity)
+        values[count++] = val;
+    }
+    constexpr void emplace_back(int8_t val) { push_back(val); }
+
+    constexpr int8_t &operator[](size_t idx) { return values[idx]; }
+    constexpr int8_t operator[](size_t idx) const { return values[idx]; }
+    const int8_t *begin() const { return values.data(); }
+    const int8_t *end() const { return values.data() + count; }
+
+    uint64_t word(size_t idx) const
+    {
+      uint64_t res;
+      memcpy(&res, values.data() + idx * sizeof(uint64_t), sizeof(uint64_t));
+      return res;
+    }
+    void set_word(size_t idx, uint64_t val) { memcpy(values.data() + idx * sizeof(uint64_t), &val, sizeof(uint64_t)); }
+
+    bool operator==(const WorldState &rhs) const = default;
+  };
+
+  // per byte add of every slot, carries don't leak into the neighbour slots
+  inline uint64_t add_slots(uint64_t a, uint64_t b)
+  {
+    constexpr uint64_t high_bits = 0x8080808080808080ull;
+    return ((a & ~high_bits) + (b & ~high_bits)) ^ ((a ^ b) & high_bits);
+  }
+
+  struct WorldStateHash
+  {
+    size_t operator()(const WorldState &ws) const
+    {
+      uint64_t res = ws.count;
+      for (size_t i = 0; i < WorldState::num_words; ++i)
+        res = (res ^ ws.word(i)) * 0x100000001b3ull;
+      const size_t hash = res ^ (res >> 32);
+      return hash;
+    }
+  };
+
   using WorldDesc = std::unordered_map<std::string, size_t>;
 };
-
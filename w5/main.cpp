@@ -6,6 +6,8 @@
 #include "roguelike.h"
 #include "dungeonGen.h"
 #include "goapPlanner.h"
+#include "goapDomain.h"
+#include "goapPlanMonitor.h"
 
 enum EnemyDist
 {
@@ -21,60 +23,153 @@ enum HealthState
   Healthy
 };
 
-static void debug_enemy_planner()
+// node expansions of both search directions on the same request
+static void compare_plan_directions(const goap::Planner &pl, const goap::WorldState &ws, const goap::WorldState &goal)
 {
-  goap::Planner pl = goap::create_planner();
+  const std::pair<goap::PlanDirection, const char *> directions[] = {
+    {goap::PlanDirection::Forward, "forward"},
+    {goap::PlanDirection::Regressive, "regressive"}};
+  for (const auto &[direction, name] : directions)
+  {
+    std::vector<goap::PlanStep> plan;
+    goap::PlanStats stats;
+    const float cost = goap::make_plan(pl, ws, goal, plan, direction, &stats);
+    printf("%10s: cost %.1f, %zu steps, %zu nodes expanded\n", name, double(cost), plan.size(), stats.expandedNodes);
+  }
+}
 
-  goap::add_states_to_planner(pl,
-      {"enemy_vis",
-       "enemy_alive",
-       "have_melee",
-       "have_ranged",
-       "enemy_dist",
-       "health_state"});
+// enemy steps back in the middle of the plan, the monitor patches it instead of planning again
+static void debug_plan_repair(const goap::Planner &pl, const goap::WorldState &ws, const goap::WorldState &goal)
+{
+  goap::PlanMonitor monitor;
+  goap::start_plan(pl, monitor, ws, goal);
+  goap::WorldState cur = ws;
+  for (size_t i = 0; i < 3 && goap::next_plan_action(monitor) != size_t(-1); ++i)
+  {
+    cur = goap::apply_action(pl, goap::next_plan_action(monitor), cur);
+    goap::complete_plan_step(monitor);
+  }
+  cur[pl.wdesc.at("enemy_dist")]++;
+  const char *statusNames[] = {"valid", "repaired", "replanned", "failed"};
+  const goap::PlanStatus status = goap::update_plan(pl, monitor, cur);
+  printf("plan after enemy stepped back: %s\n", statusNames[size_t(status)]);
+  goap::print_plan(pl, cur, monitor.plan);
+}
 
-  goap::add_action_to_planner(pl, "wander", 1,
+// the request is spread over frames with a budget of expanded nodes each
+static void debug_time_sliced_plan(const goap::Planner &pl, const goap::WorldState &ws, const goap::WorldState &goal)
+{
+  goap::PlanSearch search(pl, ws, goal);
+  std::vector<goap::PlanStep> plan;
+  size_t frame = 0;
+  for (; search.step(32) == goap::SearchStatus::Searching; ++frame)
+  {
+    const float cost = search.get_plan(plan);
+    printf("frame %zu: %zu nodes expanded, progress %.2f, best partial plan of %zu steps costs %.1f\n",
+           frame, search.expanded_nodes(), double(search.progress()), plan.size(), double(cost));
+  }
+  const float cost = search.get_plan(plan);
+  printf("frame %zu: %s, %zu steps, cost %.1f\n", frame,
+         search.status() == goap::SearchStatus::Found ? "found" : "no plan", plan.size(), double(cost));
+}
+
+// mixed requests planned on worker threads have to give the same plans as planning them one by one
+static void debug_plan_batch(const goap::Planner &pl, const goap::WorldState &ws, const goap::WorldState &goal)
+{
+  const size_t numLootSlot = pl.wdesc.at("num_loot");
+  const size_t healthSlot = pl.wdesc.at("health_state");
+  const size_t escapedSlot = pl.wdesc.at("escaped");
+  std::vector<goap::WorldState> starts;
+  std::vector<goap::WorldState> goals;
+  for (int i = 0; i < 64; ++i)
+  {
+    goap::WorldState start = ws;
+    start[numLootSlot] = int8_t(i % 6);
+    start[healthSlot] = int8_t(i % 3); // dead looters can't reach anything
+    goap::WorldState to = goal;
+    if (i % 4 == 1)
+      to[escapedSlot] = -1;
+    starts.push_back(start);
+    goals.push_back(to);
+  }
+  // second batch runs on the same workers
+  for (int batch = 0; batch < 2; ++batch)
+  {
+    const std::vector<goap::PlanResult> results = goap::plan_batch(pl, starts, goals);
+    size_t mismatches = 0;
+    for (size_t i = 0; i < starts.size(); ++i)
+    {
+      std::vector<goap::PlanStep> plan;
+      const float cost = goap::make_plan(pl, starts[i], goals[i], plan);
+      const bool same = cost == results[i].cost && plan.size() == results[i].plan.size()
+                        && std::equal(plan.begin(), plan.end(), results[i].plan.begin(),
+                                      [](const goap::PlanStep &lhs, const goap::PlanStep &rhs)
+                                      {
+                                        return lhs.action == rhs.action && lhs.worldState == rhs.worldState;
+                                      });
+      if (!same)
+        ++mismatches;
+    }
+    printf("batch %d of %zu plans: %zu differ from serial planning\n", batch, starts.size(), mismatches);
+  }
+}
+
+constexpr auto enemyDomain = goap::make_domain(
+    "enemy_vis",
+    "enemy_alive",
+    "have_melee",
+    "have_ranged",
+    "enemy_dist",
+    "health_state");
+
+constexpr goap::StaticAction enemyActions[] = {
+  goap::make_action(enemyDomain, "wander", 1,
       {{"health_state", Healthy}},
       {{"enemy_vis", 1}},
-      {});
+      {}),
 
-  goap::add_action_to_planner(pl, "approach_enemy", 1,
+  goap::make_action(enemyDomain, "approach_enemy", 1,
       {{"health_state", Healthy}, {"enemy_vis", 1}},
       {},
-      {{"enemy_dist", -1}});
+      {{"enemy_dist", -1}}),
 
-  goap::add_action_to_planner(pl, "flee_enemy", 1,
+  goap::make_action(enemyDomain, "flee_enemy", 1,
       {{"health_state", Healthy}, {"enemy_vis", 1}},
       {},
-      {{"enemy_dist", +1}});
+      {{"enemy_dist", +1}}),
 
-  goap::add_action_to_planner(pl, "find_melee", 1,
+  goap::make_action(enemyDomain, "find_melee", 1,
       {{"have_melee", 0}, {"health_state", Healthy}},
       {{"have_melee", 1}, {"enemy_dist", DistFar}},
-      {});
+      {}),
 
-  goap::add_action_to_planner(pl, "find_ranged", 1,
+  goap::make_action(enemyDomain, "find_ranged", 1,
       {{"have_ranged", 0}, {"health_state", Healthy}},
       {{"have_ranged", 1}, {"enemy_dist", DistFar}},
-      {});
+      {}),
 
-  goap::add_action_to_planner(pl, "patch_up", 1,
+  goap::make_action(enemyDomain, "patch_up", 1,
       {{"health_state", Injured}},
       {},
-      {{"health_state", +1}});
+      {{"health_state", +1}}),
 
-  goap::add_action_to_planner(pl, "attack_enemy", 1,
+  goap::make_action(enemyDomain, "attack_enemy", 1,
       {{"enemy_vis", 1}, {"enemy_alive", 1}, {"have_melee", 1}, {"enemy_dist", DistMelee}, {"health_state", Healthy}},
       {{"enemy_alive", 0}},
-      {{"health_state", -1}});
+      {{"health_state", -1}}),
 
-  goap::add_action_to_planner(pl, "shoot_enemy", 1,
+  goap::make_action(enemyDomain, "shoot_enemy", 1,
       {{"enemy_vis", 1}, {"enemy_alive", 1}, {"have_ranged", 1}, {"enemy_dist", DistRanged}, {"health_state", Healthy}},
       {{"enemy_alive", 0}},
-      {});
+      {})
+};
+
+static void debug_enemy_planner()
+{
+  goap::Planner pl = goap::create_planner(enemyDomain, enemyActions);
 
   {
-    goap::WorldState ws = goap::produce_planner_worldstate(pl,
+    constexpr goap::WorldState ws = goap::make_worldstate(enemyDomain,
         {{"enemy_vis", 0},
          {"enemy_alive", 1},
          {"have_melee", 0},
@@ -82,15 +177,16 @@ static void debug_enemy_planner()
          {"enemy_dist", DistFar},
          {"health_state", Healthy}});
 
-    goap::WorldState goal = goap::produce_planner_worldstate(pl,
+    constexpr goap::WorldState goal = goap::make_worldstate(enemyDomain,
         {{"enemy_alive", 0}, {"health_state", Healthy}});
 
     std::vector<goap::PlanStep> plan;
     goap::make_plan(pl, ws, goal, plan);
     goap::print_plan(pl, ws, plan);
+    compare_plan_directions(pl, ws, goal);
   }
   {
-    goap::WorldState ws = goap::produce_planner_worldstate(pl,
+    constexpr goap::WorldState ws = goap::make_worldstate(enemyDomain,
         {{"enemy_vis", 0},
          {"enemy_alive", 1},
          {"have_melee", 0},
@@ -98,80 +194,83 @@ static void debug_enemy_planner()
          {"enemy_dist", DistMelee},
          {"health_state", Healthy}});
 
-    goap::WorldState goal = goap::produce_planner_worldstate(pl,
+    constexpr goap::WorldState goal = goap::make_worldstate(enemyDomain,
         {{"enemy_alive", 0}, {"health_state", Healthy}, {"enemy_dist", DistMelee}});
 
     std::vector<goap::PlanStep> plan;
     goap::make_plan(pl, ws, goal, plan);
     goap::print_plan(pl, ws, plan);
+    compare_plan_directions(pl, ws, goal);
   }
 }
 
-static void debug_looter_planner()
-{
-  goap::Planner pl = goap::create_planner();
-
-  goap::add_states_to_planner(pl,
-      {"enemy_vis",
-       "loot_vis",
-       "num_loot",
-       "have_melee",
-       "have_ranged",
-       "enemy_dist",
-       "health_state",
-       "escaped"});
-
-  goap::add_action_to_planner(pl, "open_room", 1,
+constexpr auto looterDomain = goap::make_domain(
+    "enemy_vis",
+    "loot_vis",
+    "num_loot",
+    "have_melee",
+    "have_ranged",
+    "enemy_dist",
+    "health_state",
+    "escaped");
+
+constexpr goap::StaticAction looterActions[] = {
+  goap::make_action(looterDomain, "open_room", 1,
       {{"health_state", Healthy}},
       {{"enemy_vis", 1}, {"loot_vis", 1}, {"enemy_dist", 2}},
-      {});
+      {}),
 
-  goap::add_action_to_planner(pl, "loot", 1,
+  goap::make_action(looterDomain, "loot", 1,
       {{"health_state", Healthy}, {"loot_vis", 1}, {"enemy_vis", 0}},
       {{"loot_vis", 0}},
-      {{"num_loot", +1}});
+      {{"num_loot", +1}}),
 
-  goap::add_action_to_planner(pl, "approach_enemy", 1,
+  goap::make_action(looterDomain, "approach_enemy", 1,
       {{"health_state", Healthy}, {"enemy_vis", 1}},
       {},
-      {{"enemy_dist", -1}});
+      {{"enemy_dist", -1}}),
 
-  goap::add_action_to_planner(pl, "flee_enemy", 1,
+  goap::make_action(looterDomain, "flee_enemy", 1,
       {{"health_state", Healthy}, {"enemy_vis", 1}},
       {},
-      {{"enemy_dist", +1}});
+      {{"enemy_dist", +1}}),
 
-  goap::add_action_to_planner(pl, "find_melee", 1,
+  goap::make_action(looterDomain, "find_melee", 1,
       {{"have_melee", 0}, {"health_state", Healthy}},
       {{"have_melee", 1}},
-      {});
+      {}),
 
-  goap::add_action_to_planner(pl, "find_ranged", 1,
+  goap::make_action(looterDomain, "find_ranged", 1,
       {{"have_ranged", 0}, {"health_state", Healthy}},
       {{"have_ranged", 1}},
-      {});
+      {}),
 
-  goap::add_action_to_planner(pl, "patch_up", 1,
+  goap::make_action(looterDomain, "patch_up", 1,
       {{"health_state", Injured}},
       {},
-      {{"health_state", +1}});
+      {{"health_state", +1}}),
 
-  goap::add_action_to_planner(pl, "attack_enemy", 1,
+  goap::make_action(looterDomain, "attack_enemy", 1,
       {{"enemy_vis", 1}, {"have_melee", 1}, {"enemy_dist", DistMelee}, {"health_state", Healthy}},
       {{"enemy_vis", 0}},
-      {{"health_state", -1}});
+      {{"health_state", -1}}),
 
-  goap::add_action_to_planner(pl, "shoot_enemy", 5,
+  goap::make_action(looterDomain, "shoot_enemy", 5,
       {{"enemy_vis", 1}, {"have_ranged", 1}, {"enemy_dist", DistRanged}, {"health_state", Healthy}},
       {{"enemy_vis", 0}},
-      {{"health_state", -1}});
+      {{"health_state", -1}}),
 
-  goap::add_action_to_planner(pl, "escape", 1,
+  goap::make_action(looterDomain, "escape", 1,
       {{"health_state", Healthy}, {"num_loot", 5}},
       {{"escaped", 1}},
-      {});
+      {})
+};
+
+static void debug_looter_planner()
+{
+  goap::Planner pl = goap::create_planner(looterDomain, looterActions);
 
-  goap::WorldState ws = goap::produce_planner_worldstate(pl,
+  constexpr goap::WorldState ws = goap::make_worldstate(looterDomain,
       {{"enemy_vis", 0},
        {"loot_vis", 1},
        {"num_loot", 0},
@@ -181,13 +280,17 @@ static void debug_looter_planner()
        {"health_state", Healthy},
        {"escaped", 0}});
 
-  goap::WorldState goal = goap::produce_planner_worldstate(pl,
+  constexpr goap::WorldState goal = goap::make_worldstate(looterDomain,
       {{"num_loot", 5}, {"escaped", 1}, {"health_state", Healthy}});
 
   std::vector<goap::PlanStep> plan;
   // goap::make_plan(pl, ws, goal, plan);
   goap::make_plan_ida_star(pl, ws, goal, plan);
   goap::print_plan(pl, ws, plan);
+  compare_plan_directions(pl, ws, goal);
+  debug_plan_repair(pl, ws, goal);
+  debug_time_sliced_plan(pl, ws, goal);
+  debug_plan_batch(pl, ws, goal);
 }
 
 
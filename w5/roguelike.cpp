@@ -9,7 +9,13 @@
 #include "dijkstraMapGen.h"
 #include "dmapFollower.h"
 #include "dmapBeh.h"
+#include "dmapJobs.h"
+#include "dmapRegistry.h"
 #include "rlikeObjects.h"
+#include "spatialHash.h"
+
+#include <memory>
+#include <algorithm>
 
 
 static void register_roguelike_systems(flecs::world &ecs)
@@ -86,21 +92,27 @@ static void register_roguelike_systems(flecs::world &ecs)
     {
       dungeonDataQuery.each([&](const DungeonData &dd)
       {
-        for (size_t y = 0; y < dd.height; ++y)
-          for (size_t x = 0; x < dd.width; ++x)
+        // resolve every map once, the per tile loop only sums values
+        std::vector<float> sums(dd.width * dd.height, 0.f);
+        for (size_t i = 0; i < wt.count; ++i)
+        {
+          const DmapWeights::WtData &mapWt = wt.weights[i];
+          dmaps::get_map_entity(ecs, mapWt.map).get([&](const DijkstraMapData &dmap)
           {
-            float sum = 0.f;
-            for (const auto &pair : wt.weights)
+            for (size_t j = 0; j < sums.size(); ++j)
             {
-              ecs.entity(pair.first.c_str()).get([&](const DijkstraMapData &dmap)
-              {
-                float v = dmap.map[y * dd.width + x];
-                if (v < 1e5f)
-                  sum += powf(v * pair.second.mult, pair.second.pow);
-                else
-                  sum += v;
-              });
+              const float v = dmap.at(j);
+              if (v < 1e5f)
+                sums[j] += powf(v * mapWt.mult, mapWt.pow);
+              else
+                sums[j] += v;
             }
+          });
+        }
+        for (size_t y = 0; y < dd.height; ++y)
+          for (size_t x = 0; x < dd.width; ++x)
+          {
+            const float sum = sums[y * dd.width + x];
             if (sum < 1e5f)
               DrawText(TextFormat("%.1f", sum),
                   int((float(x) + 0.2f) * tile_size), int((float(y) + 0.5f) * tile_size), 150, WHITE);
@@ -116,7 +128,7 @@ static void register_roguelike_systems(flecs::world &ecs)
         for (size_t y = 0; y < dd.height; ++y)
           for (size_t x = 0; x < dd.width; ++x)
           {
-            const float val = dmap.map[y * dd.width + x];
+            const float val = dmap.at(y * dd.width + x);
             if (val < 1e5f)
               DrawText(TextFormat("%.1f", val),
                   int((float(x) + 0.2f) * tile_size), int((float(y) + 0.5f) * tile_size), 150, WHITE);
@@ -152,6 +164,8 @@ void init_roguelike(flecs::world &ecs)
   ecs.entity("world")
     .set(TurnCounter{})
     .set(ActionLog{});
+
+  get_spatial_hash().rebuild(ecs);
 }
 
 void init_dungeon(flecs::world &ecs, char *tiles, size_t w, size_t h)
@@ -166,8 +180,10 @@ void init_dungeon(flecs::world &ecs, char *tiles, size_t w, size_t h)
   for (size_t y = 0; y < h; ++y)
     for (size_t x = 0; x < w; ++x)
       dungeonData[y * w + x] = tiles[y * w + x];
+  DungeonData dd{dungeonData, w, h};
   ecs.entity("dungeon")
-    .set(DungeonData{dungeonData, w, h});
+    .set(DungeonSnapshot{std::make_shared<const DungeonData>(dd)})
+    .set(std::move(dd));
 
   for (size_t y = 0; y < h; ++y)
     for (size_t x = 0; x < w; ++x)
@@ -313,6 +329,8 @@ static void process_actions(flecs::world &ecs)
       });
     });
   });
+  // everyone has moved, sensors of the next turn query the new positions
+  get_spatial_hash().rebuild(ecs);
 }
 
 template<typename T>
@@ -329,7 +347,8 @@ static void gather_world_info(flecs::world &ecs)
                                           const Position, const Hitpoints,
                                           const WorldInfoGatherer,
                                           const Team>();
-  static auto alliesQuery = ecs.query<const Position, const Team>();
+  const SpatialHash &spatialHash = get_spatial_hash();
+  static std::vector<SpatialEntry> closest;
   gatherWorldInfo.each([&](Blackboard &bb, const Position &pos, const Hitpoints &hp,
                            WorldInfoGatherer, const Team &team)
   {
@@ -337,23 +356,65 @@ static void gather_world_info(flecs::world &ecs)
     push_info_to_bb(bb, "hp", hp.hitpoints);
     float numAllies = 0; // note float
     float closestEnemyDist = 100.f;
-    alliesQuery.each([&](const Position &apos, const Team &ateam)
+    constexpr float limitDist = 5.f;
+    spatialHash.within_radius(pos, limitDist, team.team, TeamFilter::SameTeam, [&](const SpatialEntry &, int distSq)
     {
-      constexpr float limitDist = 5.f;
-      if (team.team == ateam.team && dist_sq(pos, apos) < sqr(limitDist))
+      if (float(distSq) < sqr(limitDist))
         numAllies += 1.f;
-      if (team.team != ateam.team)
-      {
-        const float enemyDist = dist(pos, apos);
-        if (enemyDist < closestEnemyDist)
-          closestEnemyDist = enemyDist;
-      }
     });
+    spatialHash.k_nearest(pos, team.team, TeamFilter::OtherTeams, 1, closest);
+    if (!closest.empty())
+      closestEnemyDist = std::min(closestEnemyDist, dist(pos, closest[0].pos));
     push_info_to_bb(bb, "alliesNum", numAllies);
     push_info_to_bb(bb, "enemyDist", closestEnemyDist);
   });
 }
 
+static std::shared_ptr<const DungeonData> get_dungeon_data(flecs::world &ecs)
+{
+  static auto dungeonSnapshotQuery = ecs.query<const DungeonSnapshot>();
+  std::shared_ptr<const DungeonData> res;
+  dungeonSnapshotQuery.each([&](const DungeonSnapshot &snapshot)
+  {
+    res = snapshot.data;
+  });
+  return res;
+}
+
+// gathers sources for all maps on the main thread and hands generation over to the job system
+static void schedule_dmaps(flecs::world &ecs)
+{
+  static auto characterPositionQuery = ecs.query<const Position, const Team>();
+  static auto hiveQuery = ecs.query<const Position, const Hive>();
+
+  std::shared_ptr<const DungeonData> dd = get_dungeon_data(ecs);
+  std::vector<Position> players;
+  characterPositionQuery.each([&](const Position &pos, const Team &t)
+  {
+    if (t.team == 0) // player team hardcode
+      players.push_back(pos);
+  });
+  std::vector<Position> hives;
+  hiveQuery.each([&](const Position &pos, const Hive &)
+  {
+    hives.push_back(pos);
+  });
+
+  dmaps::JobSystem &jobs = dmaps::get_job_system();
+  // flee map is built from the approach map of the same turn instead of generating it again
+  jobs.add_map("approach_map", [dd, players](std::vector<float> &map)
+  {
+    dmaps::gen_player_approach_map(*dd, players, map);
+  }, {{"flee_map", [dd](const std::vector<float> &approach_map, std::vector<float> &map)
+  {
+    dmaps::gen_player_flee_map(*dd, approach_map, map);
+  }}});
+  jobs.add_map("hive_map", [dd, hives](std::vector<float> &map)
+  {
+    dmaps::gen_hive_pack_map(*dd, hives, map);
+  });
+}
+
 void process_turn(flecs::world &ecs)
 {
   static auto stateMachineAct = ecs.query<StateMachine>();
@@ -361,6 +422,8 @@ void process_turn(flecs::world &ecs)
   static auto turnIncrementer = ecs.query<TurnCounter>();
   if (is_player_acted(ecs))
   {
+    // maps scheduled on the previous turn have to be ready before followers read them
+    dmaps::get_job_system().sync(ecs);
     if (upd_player_actions_count(ecs))
     {
       // Plan action for NPCs
@@ -381,24 +444,11 @@ void process_turn(flecs::world &ecs)
     }
     process_actions(ecs);
 
-    std::vector<float> approachMap;
-    dmaps::gen_player_approach_map(ecs, approachMap);
-    ecs.entity("approach_map")
-      .set(DijkstraMapData{approachMap});
-
-    std::vector<float> fleeMap;
-    dmaps::gen_player_flee_map(ecs, fleeMap);
-    ecs.entity("flee_map")
-      .set(DijkstraMapData{fleeMap});
-
-    std::vector<float> hiveMap;
-    dmaps::gen_hive_pack_map(ecs, hiveMap);
-    ecs.entity("hive_map")
-      .set(DijkstraMapData{hiveMap});
+    schedule_dmaps(ecs);
 
     //ecs.entity("flee_map").add<VisualiseMap>();
     ecs.entity("hive_follower_sum")
-      .set(DmapWeights{{{"hive_map", {1.f, 1.f}}, {"approach_map", {1.8f, 0.8f}}}})
+      .set(dmaps::make_weights({{"hive_map", 1.f, 1.f}, {"approach_map", 1.8f, 0.8f}}))
       .add<VisualiseMap>();
   }
 }
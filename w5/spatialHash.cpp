@@ -0,0 +1,111 @@
+#include "spatialHash.h"
+#include <algorithm>
+#include <bit>
+
+void SpatialHash::rebuild(flecs::world &ecs)
+{
+  static auto charactersQuery = ecs.query<const Position, const Team>();
+  for (TeamGrid &grid : grids)
+    grid.entries.clear();
+  uint32_t order = 0;
+  charactersQuery.each([&](flecs::entity e, const Position &pos, const Team &t)
+  {
+    auto itf = std::find_if(grids.begin(), grids.end(), [&](const TeamGrid &grid) { return grid.team == t.team; });
+    TeamGrid &grid = itf != grids.end() ? *itf : grids.emplace_back();
+    grid.team = t.team;
+    grid.entries.push_back({e, pos, t.team, order++});
+  });
+  std::erase_if(grids, [](const TeamGrid &grid) { return grid.entries.empty(); });
+
+  // counting sort of the entries into buckets
+  std::vector<SpatialEntry> &sorted = sortScratch;
+  for (TeamGrid &grid : grids)
+  {
+    const size_t numBuckets = std::bit_ceil(std::max<size_t>(grid.entries.size() * 2, 16));
+    grid.bucketStart.assign(numBuckets + 1, 0u);
+    grid.minCellX = grid.minCellY = INT32_MAX;
+    grid.maxCellX = grid.maxCellY = INT32_MIN;
+    for (const SpatialEntry &entry : grid.entries)
+    {
+      const int cx = cell_coord(entry.pos.x);
+      const int cy = cell_coord(entry.pos.y);
+      grid.minCellX = std::min(grid.minCellX, cx);
+      grid.minCellY = std::min(grid.minCellY, cy);
+      grid.maxCellX = std::max(grid.maxCellX, cx);
+      grid.maxCellY = std::max(grid.maxCellY, cy);
+      grid.bucketStart[bucket_of(grid, cx, cy) + 1]++;
+    }
+    for (size_t i = 1; i <= numBuckets; ++i)
+      grid.bucketStart[i] += grid.bucketStart[i - 1];
+    sorted.resize(grid.entries.size());
+    std::vector<uint32_t> &fill = grid.bucketStart; // moved one bucket forward while filling, restored below
+    for (const SpatialEntry &entry : grid.entries)
+      sorted[fill[bucket_of(grid, cell_coord(entry.pos.x), cell_coord(entry.pos.y))]++] = entry;
+    for (size_t i = numBuckets; i > 0; --i)
+      fill[i] = fill[i - 1];
+    fill[0] = 0;
+    grid.entries.swap(sorted);
+  }
+}
+
+void SpatialHash::k_nearest(const Position &pos, int team, TeamFilter filter, size_t k,
+                            std::vector<SpatialEntry> &res, flecs::entity exclude) const
+{
+  res.clear();
+  if (k == 0)
+    return;
+  struct Found
+  {
+    int distSq;
+    SpatialEntry entry;
+  };
+  auto closer = [](const Found &lhs, const Found &rhs)
+  {
+    return lhs.distSq != rhs.distSq ? lhs.distSq < rhs.distSq : lhs.entry.order < rhs.entry.order;
+  };
+  thread_local std::vector<Found> best; // sorted, at most k, per thread so queries can run concurrently
+  best.clear();
+  auto consider = [&](const SpatialEntry &entry)
+  {
+    if (entry.entity == exclude)
+      return;
+    const int dx = entry.pos.x - pos.x;
+    const int dy = entry.pos.y - pos.y;
+    const Found found{dx * dx + dy * dy, entry};
+    if (best.size() == k && !closer(found, best.back()))
+      return;
+    if (best.size() == k)
+      best.pop_back();
+    best.insert(std::upper_bound(best.begin(), best.end(), found, closer), found);
+  };
+
+  const int pcx = cell_coord(pos.x);
+  const int pcy = cell_coord(pos.y);
+  for (const TeamGrid &grid : grids)
+  {
+    if (!matches(grid, team, filter))
+      continue;
+    const int maxRing = std::max({pcx - grid.minCellX, grid.maxCellX - pcx, pcy - grid.minCellY, grid.maxCellY - pcy});
+    for (int ring = 0; ring <= maxRing; ++ring)
+    {
+      // the ring is at least that far away along one of the axes, a tie would still have to be checked
+      const int ringDist = ring > 0 ? (ring - 1) * cell_size + 1 : 0;
+      if (best.size() == k && best.back().distSq < ringDist * ringDist)
+        break;
+      for (int cy = pcy - ring; cy <= pcy + ring; ++cy)
+      {
+        const bool edgeRow = cy == pcy - ring || cy == pcy + ring;
+        for (int cx = pcx - ring; cx <= pcx + ring; cx += edgeRow ? 1 : 2 * ring)
+          for_each_in_cell(grid, cx, cy, consider);
+      }
+    }
+  }
+  for (const Found &found : best)
+    res.push_back(found.entry);
+}
+
+SpatialHash &get_spatial_hash()
+{
+  static SpatialHash hash;
+  return hash;
+}
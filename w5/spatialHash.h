@@ -0,0 +1,95 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <flecs.h>
+#include "ecsTypes.h"
+
+struct SpatialEntry
+{
+  flecs::entity entity;
+  Position pos;
+  int team;
+  uint32_t order; // position in the query at rebuild, ties in distance go to the earlier entry
+};
+
+enum class TeamFilter
+{
+  SameTeam,
+  OtherTeams
+};
+
+// Uniform grid over positions of everyone with a Team, a grid per team.
+// Cells are hashed into buckets, so the world doesn't need bounds. Rebuilt once per turn.
+class SpatialHash
+{
+  static constexpr int cell_size = 8;
+
+  struct TeamGrid
+  {
+    int team = 0;
+    std::vector<uint32_t> bucketStart; // entries of a bucket are [bucketStart[b], bucketStart[b + 1])
+    std::vector<SpatialEntry> entries; // sorted by bucket
+    int minCellX = 0, minCellY = 0, maxCellX = 0, maxCellY = 0;
+  };
+  std::vector<TeamGrid> grids;
+  std::vector<SpatialEntry> sortScratch; // counting sort target of rebuild, kept so it doesn't allocate every turn
+
+  static int cell_coord(int v) { return v >= 0 ? v / cell_size : (v + 1) / cell_size - 1; }
+  static size_t bucket_of(const TeamGrid &grid, int cx, int cy)
+  {
+    const uint32_t hash = uint32_t(cx) * 73856093u ^ uint32_t(cy) * 19349663u;
+    return hash & (grid.bucketStart.size() - 2);
+  }
+  static bool matches(const TeamGrid &grid, int team, TeamFilter filter)
+  {
+    return (grid.team == team) == (filter == TeamFilter::SameTeam);
+  }
+
+  // calls c(entry) for entries in the cell of the grid
+  template<typename Callable>
+  static void for_each_in_cell(const TeamGrid &grid, int cx, int cy, Callable c)
+  {
+    if (cx < grid.minCellX || cx > grid.maxCellX || cy < grid.minCellY || cy > grid.maxCellY)
+      return;
+    const size_t bucket = bucket_of(grid, cx, cy);
+    for (uint32_t i = grid.bucketStart[bucket]; i < grid.bucketStart[bucket + 1]; ++i)
+    {
+      const SpatialEntry &entry = grid.entries[i];
+      if (cell_coord(entry.pos.x) == cx && cell_coord(entry.pos.y) == cy) // buckets are shared by cells
+        c(entry);
+    }
+  }
+
+public:
+  void rebuild(flecs::world &ecs);
+
+  // up to k entries closest to pos, closest first, exclude is skipped
+  void k_nearest(const Position &pos, int team, TeamFilter filter, size_t k, std::vector<SpatialEntry> &res,
+                 flecs::entity exclude = flecs::entity()) const;
+
+  // calls c(entry, dist_sq) for every entry not further than radius
+  template<typename Callable>
+  void within_radius(const Position &pos, float radius, int team, TeamFilter filter, Callable c) const
+  {
+    const int r = int(radius);
+    const int maxDistSq = int(radius * radius);
+    for (const TeamGrid &grid : grids)
+    {
+      if (!matches(grid, team, filter))
+        continue;
+      for (int cy = cell_coord(pos.y - r); cy <= cell_coord(pos.y + r); ++cy)
+        for (int cx = cell_coord(pos.x - r); cx <= cell_coord(pos.x + r); ++cx)
+          for_each_in_cell(grid, cx, cy, [&](const SpatialEntry &entry)
+          {
+            const int dx = entry.pos.x - pos.x;
+            const int dy = entry.pos.y - pos.y;
+            const int distSq = dx * dx + dy * dy;
+            if (distSq <= maxDistSq)
+              c(entry, distSq);
+          });
+    }
+  }
+};
+
+SpatialHash &get_spatial_hash();